@@ -11,6 +11,16 @@
 
 #include <linux/platform_device.h>
 #include <linux/spinlock_types.h>
+#include <linux/atomic.h>
+#include <linux/cache.h>
+#include <linux/percpu.h>
+#include <linux/log2.h>
+#include <linux/hrtimer.h>
+#include <linux/irq_work.h>
+#include <linux/list.h>
+#include <linux/wait.h>
+#include <linux/mutex.h>
+#include <linux/dma-fence.h>
 
 #include <drm/drm_device.h>
 #include <drm/drm_drv.h>
@@ -18,55 +28,197 @@
 
 #include "uapi/sched_test.h"
 
+/* Job lifecycle events counted per queue */
+enum sched_test_stat {
+	SCHED_TEST_STAT_SUBMITTED,
+	SCHED_TEST_STAT_RUN,
+	SCHED_TEST_STAT_SIGNALED,
+	SCHED_TEST_STAT_FREED,
+	SCHED_TEST_STAT_MAX
+};
+
+/* Job lifecycle intervals with a latency histogram per queue */
+enum sched_test_lat {
+	/* drm_sched_entity_push_job() to run_job */
+	SCHED_TEST_LAT_SUBMIT_RUN,
+	/* run_job to the emulated HW signaling the irq fence */
+	SCHED_TEST_LAT_RUN_SIGNAL,
+	/* irq fence signaled to free_job */
+	SCHED_TEST_LAT_SIGNAL_FREE,
+	SCHED_TEST_LAT_MAX
+};
+
+/* log2 buckets of a latency in ns, the last bucket takes everything from 2^39 ns up */
+#define SCHED_TEST_LAT_HIST_BUCKETS	40
+
+/*
+ * Per-CPU queue statistics, updated without any shared cache line on the hot path and
+ * summed up over all CPUs when read through debugfs
+ */
+struct sched_test_queue_stats {
+	u64 count[SCHED_TEST_STAT_MAX];
+	u64 lat_hist[SCHED_TEST_LAT_MAX][SCHED_TEST_LAT_HIST_BUCKETS];
+};
+
+/*
+ * In-driver FIFO replacing drm_sched on a scheduler bypass queue, see bypass_queues.
+ * Jobs are queued in push order and wait for their dependencies with one dma_fence
+ * callback each. Ready jobs are handed to the emulated HW strictly from the head of
+ * the FIFO, with no more than SCHED_TEST_HW_JOBS_LIMIT in flight, like a drm_sched
+ * entity on its scheduler. The lock is taken from fence callbacks, under job_lock, so no
+ * fence lock may be taken while holding it; this includes kicking the emulated HW,
+ * which sched_test_hwemu_kick() asserts.
+ */
+struct sched_test_bypass {
+	spinlock_t lock;
+	struct list_head fifo;
+	unsigned int in_flight;
+	/* Woken up when the FIFO is empty and nothing is in flight */
+	wait_queue_head_t idle;
+};
+
 struct sched_test_queue_state {
 	struct drm_gpu_scheduler sched;
+	/* Jobs of the queue bypass sched and go through the bypass FIFO */
+	bool bypass;
+	struct sched_test_bypass bypass_fifo;
 	u64 fence_context;
 	u64 emit_seqno;
+	/* Queue suffix, "A" to "Z" followed by numbers, and the scheduler name built from it */
+	char tag[4];
+	char name[16];
+	struct sched_test_queue_stats __percpu *stats;
 };
 
+/* Maximum number of jobs the DRM scheduler keeps in flight on one emulated HW queue */
+#define SCHED_TEST_HW_JOBS_LIMIT	16
+/* Number of descriptors in the emulated HW ring, a power of two */
+#define SCHED_TEST_RING_SHIFT		6
+#define SCHED_TEST_RING_SIZE		(1U << SCHED_TEST_RING_SHIFT)
+
+/*
+ * HW emulation model uses a ring of event descriptors. The event is embedded in the
+ * job so run_job does not need to allocate one.
+ */
+struct sched_test_event {
+	/* Job object added by the scheduler */
+	struct sched_test_job *job;
+	/* Ring position the event was queued at */
+	u32 seq;
+	/* When the job was queued and, once the emulated HW picks it up, when it completes */
+	u64 queued_ns;
+	u64 due_ns;
+};
+
+/*
+ * Single producer single consumer descriptor ring, modeled on a HW ring buffer. The
+ * DRM scheduler thread of the queue is the only producer and advances tail; the HW
+ * emulation thread is the only consumer and advances head. The indices are free
+ * running and live on their own cache lines so the two sides do not share a line
+ * except when passing descriptors. The scheduler never has more than
+ * SCHED_TEST_HW_JOBS_LIMIT jobs in flight, but the slots of a retired batch are only
+ * handed back once the whole batch is signaled, so the ring must hold twice that.
+ */
+struct sched_test_ring {
+	u32 tail ____cacheline_aligned_in_smp;
+	u32 head ____cacheline_aligned_in_smp;
+	struct sched_test_event *slots[SCHED_TEST_RING_SIZE] ____cacheline_aligned_in_smp;
+};
+
+/* Shorter waits for the emulated HW are busy-waited, longer ones sleep on a hrtimer */
+#define SCHED_TEST_SERVICE_SPIN_NS	2000
+
+/* Service time model of the emulated HW, see enum sched_test_service_model */
+struct sched_test_service {
+	u32 model;
+	u64 param0_ns;
+	u64 param1_ns;
+	u32 permille;
+};
+
+/* log2 buckets for the number of jobs retired per HW emulation thread wakeup */
+#define SCHED_TEST_BATCH_HIST_BUCKETS	(SCHED_TEST_RING_SHIFT + 1)
+
 /* Helper struct for the HW emulation thread */
 struct sched_test_hwemu {
 	struct sched_test_device *dev;
 	/* Kernel thread emulating HW and processing jobs submitted by the DRM scheduler */
 	struct task_struct *hwemu_thread;
-	/* List of jobs to be processed by the kernel thread -- queue for the HW emulation thread */
-	struct list_head events_list;
-	/* Used to protect the job (events_list) queue */
-	spinlock_t events_lock;
 	/* Used for irq_fence locking between scheduler and HW emulation thread */
 	spinlock_t job_lock;
-	/* Count of jobs processed */
+	/* Count of jobs processed, protected by job_lock like the two below */
 	unsigned long count;
+	/* Count of wakeups which found work, and histogram of jobs retired per such wakeup */
+	unsigned long wakeups;
+	unsigned long batch_hist[SCHED_TEST_BATCH_HIST_BUCKETS];
+	/* Current adaptive busy-poll window, see hwemu_poll_us */
+	u64 poll_ns;
+	/* Total time spent busy-polling and the number of polls which found work or gave up */
+	u64 poll_time_ns;
+	unsigned long poll_hits;
+	unsigned long poll_misses;
+	/* The HW emulation thread sleeps here when the ring is empty */
 	wait_queue_head_t wq;
+	/* Service time model, protected by job_lock */
+	struct sched_test_service service;
+	/* Completion time of the last job picked up by the emulated HW */
+	u64 last_due_ns;
+	/* enum sched_test_backend, written under job_lock */
+	u32 backend;
+	/* Completion interrupt of the hrtimer backend */
+	struct hrtimer timer;
+	/* The timer is queued or its callback is running, protected by job_lock */
+	bool timer_armed;
+	/* Kicks the emulated HW on behalf of fence callbacks, see sched_test_bypass_kick() */
+	struct irq_work kick_work;
+	/* CPUs the HW emulation thread and the queue's drm_sched thread are pinned to, or -1 */
+	int cpu;
+	int sched_cpu;
 
 	enum sched_test_queue qu;
+	/* Queue for the HW emulation thread */
+	struct sched_test_ring ring;
 };
 
 struct sched_test_device {
 	struct drm_device drm;
 	struct platform_device *platform;
-        struct sched_test_queue_state queue[SCHED_TSTQ_MAX];
+	/* Number of queues, each with its own scheduler and HW emulation thread */
+	unsigned int num_queues;
+	struct sched_test_queue_state *queue;
 	/* Abstraction for emulated HW queues*/
-	struct sched_test_hwemu *hwemu[SCHED_TSTQ_MAX];
+	struct sched_test_hwemu **hwemu;
+	/* Schedulers of the equivalent queues a balanced entity spreads its jobs over */
+	struct drm_gpu_scheduler **balance_list;
+	unsigned int num_balance;
+	/* Slab cache backing sched_test_job objects */
+	struct kmem_cache *job_cache;
+	/* Slab statistics, number of job objects handed out by and returned to job_cache */
+	atomic64_t job_allocs;
+	atomic64_t job_frees;
 };
 
 /* File private data structure */
 struct sched_test_file_priv {
 	struct sched_test_device *sdev;
-	struct drm_sched_entity entity[SCHED_TSTQ_MAX];
+	/* One entity per queue and priority, see sched_test_entity() */
+	struct drm_sched_entity *entity;
+	/* Entities spanning sched_test_device::balance_list, one per priority */
+	struct drm_sched_entity balanced[SCHED_TEST_PRIORITY_MAX];
+	/*
+	 * Held from arming a job to pushing it, nothing else: threads sharing the file
+	 * must not interleave the two on an entity or finished fences signal out of seqno
+	 * order
+	 */
+	struct mutex submit_lock;
 };
 
-struct sched_test_job {
-	struct drm_sched_job base;
-	struct sched_test_device *sdev;
-	/* The 'done' fence (if any) of another job this job is dependent on */
-//	struct dma_fence *in_fence;
-	/* Reference to the 'finished' fence owned by the drm_sched_job */
-	struct dma_fence *done_fence;
-	/* Fence created by the driver and used between the DRM scheduler and the emulated HW thread */
-	struct dma_fence *irq_fence;
-	enum sched_test_queue qu;
-};
+static inline struct drm_sched_entity *sched_test_entity(struct sched_test_file_priv *priv,
+							 enum sched_test_queue qu,
+							 enum sched_test_priority prio)
+{
+	return &priv->entity[qu * SCHED_TEST_PRIORITY_MAX + prio];
+}
 
 /* Models the IRQ fence */
 struct sched_test_fence {
@@ -76,6 +228,46 @@ struct sched_test_fence {
 	enum sched_test_queue qu;
 };
 
+/* A dependency of a job on a bypass queue and the callback waiting for it */
+struct sched_test_bypass_dep {
+	struct dma_fence_cb cb;
+	struct dma_fence *fence;
+	struct sched_test_job *job;
+};
+
+/*
+ * A job is a single allocation from sched_test_device::job_cache. The IRQ fence is
+ * embedded and refcounted; once run_job has initialized it the job memory is only
+ * returned to the cache from sched_test_fence_release().
+ */
+struct sched_test_job {
+	struct drm_sched_job base;
+	struct sched_test_device *sdev;
+	/* Reference to the 'finished' fence owned by the drm_sched_job, set when armed */
+	struct dma_fence *done_fence;
+	/* Fence used between the DRM scheduler and the emulated HW thread */
+	struct sched_test_fence irq_fence;
+	/* Descriptor handed to the emulated HW thread */
+	struct sched_test_event event;
+	enum sched_test_queue qu;
+	/* When the job was pushed to the entity and when the emulated HW signaled it */
+	u64 submit_ns;
+	u64 signal_ns;
+	/*
+	 * Jobs of a bypass queue leave base unused; done_fence is the irq fence and the
+	 * dependencies are waited for by the bypass FIFO. bypass_pending counts the
+	 * dependencies not signaled yet, bypass_error is the first error among them.
+	 */
+	bool bypass;
+	struct list_head bypass_link;
+	atomic_t bypass_pending;
+	int bypass_error;
+	struct sched_test_bypass_dep *bypass_deps;
+	u32 bypass_num_deps;
+	u32 bypass_max_deps;
+	struct dma_fence_cb bypass_done_cb;
+};
+
 static inline struct sched_test_job *to_sched_test_job(struct drm_sched_job *job)
 {
 	return container_of(job, struct sched_test_job, base);
@@ -91,13 +283,52 @@ static inline struct sched_test_fence *to_sched_test_fence(struct dma_fence *fen
 	return container_of(fence, struct sched_test_fence, base);
 }
 
+static inline enum sched_test_queue to_sched_test_queue(struct sched_test_device *sdev,
+							struct drm_gpu_scheduler *sched)
+{
+	return container_of(sched, struct sched_test_queue_state, sched) - sdev->queue;
+}
+
+static inline void sched_test_stat_inc(struct sched_test_device *sdev, enum sched_test_queue qu,
+				       enum sched_test_stat stat)
+{
+	this_cpu_inc(sdev->queue[qu].stats->count[stat]);
+}
+
+static inline void sched_test_lat_record(struct sched_test_device *sdev, enum sched_test_queue qu,
+					 enum sched_test_lat lat, u64 start_ns, u64 end_ns)
+{
+	const u64 delta = (end_ns > start_ns) ? end_ns - start_ns : 0;
+	const unsigned int bucket = min_t(unsigned int, ilog2(delta | 1), SCHED_TEST_LAT_HIST_BUCKETS - 1);
+
+	this_cpu_inc(sdev->queue[qu].stats->lat_hist[lat][bucket]);
+}
+
+const char *sched_test_queue_name(const struct sched_test_device *sdev, const enum sched_test_queue qu);
+
 int sched_test_sched_init(struct sched_test_device *sdev);
 void sched_test_sched_fini(struct sched_test_device *sdev);
 
-int sched_test_job_init(struct sched_test_job *job, struct sched_test_file_priv *priv);
+struct sched_test_job *sched_test_job_alloc(struct sched_test_device *sdev);
+void sched_test_job_destroy(struct sched_test_job *job);
+int sched_test_job_init(struct sched_test_job *job, struct drm_sched_entity *entity);
+void sched_test_job_arm(struct sched_test_job *job);
+int sched_test_bypass_job_init(struct sched_test_job *job, enum sched_test_queue qu);
+int sched_test_job_add_dependency(struct sched_test_job *job, struct dma_fence *fence);
+void sched_test_job_push(struct sched_test_job *job);
 void sched_test_job_fini(struct sched_test_job *job);
+void sched_test_job_abort(struct sched_test_job *job);
+void sched_test_bypass_drain(struct sched_test_device *sdev);
 
 int sched_test_hwemu_threads_start(struct sched_test_device *sdev);
 int sched_test_hwemu_threads_stop(struct sched_test_device *sdev);
+int sched_test_hwemu_set_service(struct sched_test_device *sdev,
+				 const struct drm_sched_test_queue_config *config);
+int sched_test_hwemu_set_affinity(struct sched_test_device *sdev, enum sched_test_queue qu,
+				  int hwemu_cpu, int sched_cpu);
+
+#if defined(CONFIG_DEBUG_FS)
+void sched_test_debugfs_init(struct drm_minor *minor);
+#endif
 
 #endif
@@ -10,6 +10,16 @@
 #include <linux/platform_device.h>
 #include <linux/kthread.h>
 #include <linux/delay.h>
+#include <linux/rcupdate.h>
+#include <linux/log2.h>
+#include <linux/sched/clock.h>
+#include <linux/hrtimer.h>
+#include <linux/ktime.h>
+#include <linux/random.h>
+#include <linux/math64.h>
+#include <linux/cpumask.h>
+#include <linux/topology.h>
+#include <linux/lockdep.h>
 
 #include <drm/drm_device.h>
 #include <drm/drm_file.h>
@@ -19,31 +29,25 @@
 #include <drm/gpu_scheduler.h>
 
 #include "sched_test_common.h"
+#include "sched_test_trace.h"
 
-#define str(x) #x
+static unsigned int hwemu_poll_us;
+module_param(hwemu_poll_us, uint, 0644);
+MODULE_PARM_DESC(hwemu_poll_us, "Busy-poll window of the HW emulation threads in us before they sleep, 0 to always sleep (default)");
 
-static const char *sched_test_queue_name(const enum sched_test_queue qu)
-{
-	switch (qu) {
-	case SCHED_TSTQ_A:
-		return str(SCHED_TSTQ_A);
-	case SCHED_TSTQ_B:
-		return str(SCHED_TSTQ_B);
-	default:
-		return "SCHED_TSTQ_??";
-	}
-}
+static int hwemu_cpus[SCHED_TEST_MAX_QUEUES] = { [0 ... SCHED_TEST_MAX_QUEUES - 1] = -1 };
+module_param_array(hwemu_cpus, int, NULL, 0444);
+MODULE_PARM_DESC(hwemu_cpus, "Per queue CPU the HW emulation thread is pinned to, with its state allocated on that CPU's node, -1 to float (default)");
 
-static const char *sched_test_hw_queue_name(const enum sched_test_queue qu)
+static unsigned long bypass_queues;
+module_param(bypass_queues, ulong, 0444);
+MODULE_PARM_DESC(bypass_queues, "Bitmask of queues whose jobs bypass drm_sched through a minimal in-driver FIFO, not the fast queue SCHED_TSTQ_B (default 0)");
+
+const char *sched_test_queue_name(const struct sched_test_device *sdev, const enum sched_test_queue qu)
 {
-	switch (qu) {
-	case SCHED_TSTQ_A:
-		return "HW_TSTQ_A";
-	case SCHED_TSTQ_B:
-		return "HW_TSTQ_B";
-	default:
-		return "HW_TSTQ_??";
-	}
+	if (qu >= sdev->num_queues)
+		return "SCHED_TSTQ_??";
+	return sdev->queue[qu].name;
 }
 
 static const char *sched_test_fence_get_driver_name(struct dma_fence *fence)
@@ -55,7 +59,16 @@ static const char *sched_test_fence_get_driver_name(struct dma_fence *fence)
 static const char *sched_test_fence_get_timeline_name(struct dma_fence *fence)
 {
 	const struct sched_test_fence *f = to_sched_test_fence(fence);
-	return sched_test_queue_name(f->qu);
+	return sched_test_queue_name(f->sdev, f->qu);
+}
+
+static void sched_test_job_free_rcu(struct rcu_head *rcu)
+{
+	struct dma_fence *fence = container_of(rcu, struct dma_fence, rcu);
+	struct sched_test_job *job = container_of(to_sched_test_fence(fence), struct sched_test_job,
+						  irq_fence);
+
+	sched_test_job_destroy(job);
 }
 
 /*
@@ -68,13 +81,17 @@ static const char *sched_test_fence_get_timeline_name(struct dma_fence *fence)
  * 2.a when the application finishes wait on a submitted job
  * 2.b when the application attempts to close the device handle without calling
  *     wait on submitted jobs, sched_test_postclose does the cleanup.
+ *
+ * The fence is embedded in the job, so dropping the last fence reference returns the
+ * whole job to the slab cache. Like dma_fence_free() this is deferred by a RCU grace
+ * period since fences may be looked at under rcu_read_lock().
  */
 void sched_test_fence_release(struct dma_fence *fence)
 {
 	struct sched_test_fence *sfence = to_sched_test_fence(fence);
 	DRM_DEBUG_DRIVER("Freeing fence object %p", sfence);
 	//dump_stack();
-	dma_fence_free(fence);
+	call_rcu(&fence->rcu, sched_test_job_free_rcu);
 }
 
 
@@ -85,14 +102,11 @@ const struct dma_fence_ops sched_test_fence_ops = {
 };
 
 /*
- * Custom routine for IRQ fence creation
+ * Custom routine for IRQ fence initialization, the fence memory is part of the job
  */
-static struct dma_fence *sched_test_fence_create(struct sched_test_device *sdev, enum sched_test_queue qu)
+static struct dma_fence *sched_test_fence_init(struct sched_test_fence *fence, struct sched_test_device *sdev,
+					       enum sched_test_queue qu)
 {
-	struct sched_test_fence *fence = kzalloc(sizeof(*fence), GFP_KERNEL);
-	if (!fence)
-		return ERR_PTR(-ENOMEM);
-
 	fence->sdev = sdev;
 	fence->qu = qu;
 	fence->seqno = ++sdev->queue[qu].emit_seqno;
@@ -102,47 +116,322 @@ static struct dma_fence *sched_test_fence_create(struct sched_test_device *sdev,
 	return &fence->base;
 }
 
+static inline bool sched_test_ring_pending(const struct sched_test_ring *ring)
+{
+	return READ_ONCE(ring->head) != READ_ONCE(ring->tail);
+}
+
+/* log2(x) in 16.16 fixed point, x >= 1 */
+static u32 sched_test_log2_fp16(u64 x)
+{
+	const u32 ip = ilog2(x);
+	/* Mantissa normalized to [1, 2) in 1.31 fixed point */
+	u64 m = (ip >= 31) ? (x >> (ip - 31)) : (x << (31 - ip));
+	u32 frac = 0;
+	int i;
+
+	for (i = 15; i >= 0; i--) {
+		m = (m * m) >> 31;
+		if (m >= (2ULL << 31)) {
+			m >>= 1;
+			frac |= 1U << i;
+		}
+	}
+	return (ip << 16) | frac;
+}
+
 /*
- * HW emulation model uses a queue of event objects
+ * Draw the service time of the next job from the queue's model. The exponential
+ * distribution is sampled by inversion, -ln(U) = ln(2) * (32 - log2(r)) for a
+ * uniform 32 bit r, all in fixed point, and its tail truncated at
+ * SCHED_TEST_SERVICE_MAX_NS.
  */
-struct event {
-	struct list_head lh;
-	/* Job object added by the scheduler */
-	struct sched_test_job *job;
-	/* Used to signal termination of HW emulation thread */
-	bool stop;
-	/* Currently unused */
-	int seq;
-};
+static u64 sched_test_service_sample(const struct sched_test_service *svc)
+{
+	/* ln(2) in 16.16 fixed point */
+	const u64 ln2_fp16 = 45426;
+	u64 neg_ln_u;
+
+	switch (svc->model) {
+	case SCHED_TEST_SERVICE_FIXED:
+		return svc->param0_ns;
+	case SCHED_TEST_SERVICE_UNIFORM:
+		return svc->param0_ns + mul_u64_u32_shr(svc->param1_ns - svc->param0_ns + 1,
+							get_random_u32(), 32);
+	case SCHED_TEST_SERVICE_EXPONENTIAL:
+		neg_ln_u = (((32ULL << 16) - sched_test_log2_fp16((u64)get_random_u32() + 1)) *
+			    ln2_fp16) >> 16;
+		return min_t(u64, mul_u64_u32_shr(svc->param0_ns, neg_ln_u, 16),
+			     SCHED_TEST_SERVICE_MAX_NS);
+	case SCHED_TEST_SERVICE_BIMODAL:
+		return ((((u64)get_random_u32() * 1000) >> 32) < svc->permille) ?
+			svc->param1_ns : svc->param0_ns;
+	default:
+		return 0;
+	}
+}
+
+/*
+ * Called by the HW emulation thread, or the hrtimer of the hrtimer backend, to retire
+ * every job pending in the queue. All the irq fences of a queue share job_lock, so
+ * like a real IRQ handler retiring several seqnos at once we signal the whole batch
+ * under one lock acquisition. Consuming the ring under job_lock also serializes the
+ * two backends while a queue switches between them.
+ *
+ * With a service time model the emulated HW picks up the jobs one after the other;
+ * a job completes its service time after the previous one completed, or after it was
+ * queued if the HW was idle. We stop at the first job which is still in service and
+ * return its completion time in next_due_ns, 0 otherwise. Returns the number of jobs
+ * retired.
+ */
+static unsigned int retire_pending_events(struct sched_test_hwemu *arg, u64 *next_due_ns)
+{
+	struct sched_test_ring *ring = &arg->ring;
+	unsigned long flags;
+	u32 tail, head, i;
+	u64 now;
+
+	*next_due_ns = 0;
+	spin_lock_irqsave(&arg->job_lock, flags);
+	/* Pairs with the release of tail by the producer, the slots are valid after this */
+	tail = smp_load_acquire(&ring->tail);
+	head = ring->head;
+	if (head == tail) {
+		spin_unlock_irqrestore(&arg->job_lock, flags);
+		return 0;
+	}
+
+	now = ktime_get_ns();
+	for (i = head; i != tail; i++) {
+		struct sched_test_event *e = ring->slots[i & (SCHED_TEST_RING_SIZE - 1)];
+		struct sched_test_job *job = e->job;
+
+		/* With a service time model the job is only picked up once */
+		if (!e->due_ns)
+			trace_sched_test_hw_dequeue(job);
+		if (arg->service.model != SCHED_TEST_SERVICE_NOP) {
+			if (!e->due_ns) {
+				e->due_ns = max(e->queued_ns, arg->last_due_ns) +
+					sched_test_service_sample(&arg->service);
+				arg->last_due_ns = e->due_ns;
+			}
+			if (e->due_ns > now) {
+				*next_due_ns = e->due_ns;
+				break;
+			}
+		}
+		/* The job may be freed as soon as its fence is signaled */
+		job->signal_ns = now;
+		sched_test_stat_inc(arg->dev, arg->qu, SCHED_TEST_STAT_SIGNALED);
+		sched_test_lat_record(arg->dev, arg->qu, SCHED_TEST_LAT_RUN_SIGNAL, e->queued_ns, now);
+		trace_sched_test_signal(job);
+		dma_fence_signal_locked(&job->irq_fence.base);
+	}
+	/* Hand the slots back to the producer only after we are done reading them */
+	smp_store_release(&ring->head, i);
+	if (i != head) {
+		arg->count += i - head;
+		arg->wakeups++;
+		arg->batch_hist[ilog2(i - head)]++;
+	}
+	spin_unlock_irqrestore(&arg->job_lock, flags);
+	return i - head;
+}
+
+/*
+ * Completion interrupt of the hrtimer backend. It runs in hard IRQ context, or in
+ * softirq context on PREEMPT_RT where the spinlock_t locks taken by the fence callbacks
+ * sleep. The timer is started by the producer when the ring goes from empty to
+ * non-empty and rearms itself for the completion time of the job in service, like HW
+ * raising an interrupt per completed batch.
+ *
+ * timer_armed makes sure the timer is only ever started from one place: while it is
+ * set nobody but this callback touches the timer, so rewriting the expiry of a running
+ * timer is safe. It is cleared under job_lock only once we return HRTIMER_NORESTART.
+ */
+static enum hrtimer_restart sched_test_hwemu_timer(struct hrtimer *timer)
+{
+	struct sched_test_hwemu *arg = container_of(timer, struct sched_test_hwemu, timer);
+	enum hrtimer_restart ret = HRTIMER_RESTART;
+	unsigned long flags;
+	u64 next_due_ns;
+
+	retire_pending_events(arg, &next_due_ns);
+	/*
+	 * Pairs with the barrier in enqueue_next_event(): either we see the job the
+	 * producer queued meanwhile, or the producer sees the ring drained and arms the
+	 * timer once we cleared timer_armed. Rather than loop in interrupt context we fire
+	 * again right away.
+	 */
+	smp_mb();
+	spin_lock_irqsave(&arg->job_lock, flags);
+	if (next_due_ns) {
+		hrtimer_set_expires(timer, ns_to_ktime(next_due_ns));
+	} else if (sched_test_ring_pending(&arg->ring)) {
+		hrtimer_set_expires(timer, ns_to_ktime(ktime_get_ns()));
+	} else {
+		arg->timer_armed = false;
+		ret = HRTIMER_NORESTART;
+	}
+	spin_unlock_irqrestore(&arg->job_lock, flags);
+	return ret;
+}
+
+/* Start the completion interrupt of the hrtimer backend unless it is already armed */
+static void sched_test_hwemu_arm_timer(struct sched_test_hwemu *arg)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&arg->job_lock, flags);
+	if (!arg->timer_armed) {
+		arg->timer_armed = true;
+		hrtimer_start(&arg->timer, ns_to_ktime(ktime_get_ns()), HRTIMER_MODE_ABS);
+	}
+	spin_unlock_irqrestore(&arg->job_lock, flags);
+}
+
+/*
+ * Wait for the emulated HW to finish servicing the job at the head of the ring. Short
+ * waits are busy-waited, longer ones sleep on a hrtimer for sub-microsecond precision.
+ */
+static void sched_test_hwemu_wait_until(struct sched_test_hwemu *arg, u64 due_ns)
+{
+	ktime_t expires = ns_to_ktime(due_ns);
+
+	if (due_ns <= ktime_get_ns() + SCHED_TEST_SERVICE_SPIN_NS) {
+		while ((ktime_get_ns() < due_ns) && !kthread_should_stop())
+			cpu_relax();
+		return;
+	}
+
+	set_current_state(TASK_INTERRUPTIBLE);
+	if (!kthread_should_stop())
+		schedule_hrtimeout_range(&expires, 0, HRTIMER_MODE_ABS);
+	__set_current_state(TASK_RUNNING);
+}
 
 /*
- * Called by the HW emulation thread to process the next job in the queue
+ * Start the emulated HW of the queue's current backend on whatever is pending in the
+ * ring. Used by the producer on an empty to non-empty transition of the ring. Arming
+ * the timer takes job_lock, so this must not be called with any fence lock held.
  */
-static struct event *dequeue_next_event(struct sched_test_hwemu *arg)
+static void sched_test_hwemu_kick(struct sched_test_hwemu *arg)
 {
-    struct event *e = NULL;
+	lockdep_assert_not_held(&arg->job_lock);
+	lockdep_assert_not_held(&arg->dev->queue[arg->qu].bypass_fifo.lock);
+	if (READ_ONCE(arg->backend) == SCHED_TEST_BACKEND_HRTIMER)
+		sched_test_hwemu_arm_timer(arg);
+	else if (waitqueue_active(&arg->wq))
+		wake_up(&arg->wq);
+}
 
-    spin_lock(&arg->events_lock);
-    if (!list_empty(&arg->events_list)) {
-	    e = list_first_entry(&arg->events_list, struct event, lh);
-	    if (e)
-		    list_del(&e->lh);
-    }
-    spin_unlock(&arg->events_lock);
-    return e;
+static void sched_test_hwemu_kick_work(struct irq_work *work)
+{
+	sched_test_hwemu_kick(container_of(work, struct sched_test_hwemu, kick_work));
+}
+
+int sched_test_hwemu_set_service(struct sched_test_device *sdev,
+				 const struct drm_sched_test_queue_config *config)
+{
+	struct sched_test_hwemu *arg = sdev->hwemu[config->qu];
+	bool switched;
+
+	if (config->model >= SCHED_TEST_SERVICE_MAX)
+		return -EINVAL;
+	if (config->backend >= SCHED_TEST_BACKEND_MAX)
+		return -EINVAL;
+	/* Bounded service times keep due_ns and the uniform range from overflowing */
+	if ((config->param0_ns > SCHED_TEST_SERVICE_MAX_NS) || (config->param1_ns > SCHED_TEST_SERVICE_MAX_NS))
+		return -EINVAL;
+	if ((config->model == SCHED_TEST_SERVICE_UNIFORM) && (config->param1_ns < config->param0_ns))
+		return -EINVAL;
+	if ((config->model == SCHED_TEST_SERVICE_BIMODAL) && (config->permille > 1000))
+		return -EINVAL;
+
+	spin_lock_irq(&arg->job_lock);
+	arg->service.model = config->model;
+	arg->service.param0_ns = config->param0_ns;
+	arg->service.param1_ns = config->param1_ns;
+	arg->service.permille = config->permille;
+	switched = (arg->backend != config->backend);
+	WRITE_ONCE(arg->backend, config->backend);
+	spin_unlock_irq(&arg->job_lock);
+
+	/*
+	 * Jobs queued around the switch may have been announced to the other backend, let
+	 * both look at the ring; they consume it under job_lock so this is safe
+	 */
+	if (switched) {
+		wake_up(&arg->wq);
+		sched_test_hwemu_arm_timer(arg);
+	}
+	return 0;
 }
 
 /*
- * Called by the scheduler thread to add the next job to the queue
+ * Called by the scheduler thread to add the next job to the queue. Returns true if
+ * the emulated HW must be kicked with sched_test_hwemu_kick(), which is left to the
+ * caller as it may hold locks the kick must not nest in.
  */
-static void enqueue_next_event(struct event *e, struct sched_test_hwemu *arg)
+static bool enqueue_next_event(struct sched_test_event *e, struct sched_test_hwemu *arg)
 {
-	static int seq = 0;
-	e->seq = seq++;
-	spin_lock(&arg->events_lock);
-	list_add_tail(&e->lh, &arg->events_list);
-	spin_unlock(&arg->events_lock);
-	wake_up(&arg->wq);
+	struct sched_test_ring *ring = &arg->ring;
+	const u32 tail = ring->tail;
+
+	if (WARN_ON_ONCE(tail - smp_load_acquire(&ring->head) >= SCHED_TEST_RING_SIZE))
+		return false;
+
+	e->seq = tail;
+	e->due_ns = 0;
+	ring->slots[tail & (SCHED_TEST_RING_SIZE - 1)] = e;
+	smp_store_release(&ring->tail, tail + 1);
+	/*
+	 * Only an empty to non-empty transition needs a wakeup, otherwise the consumer is
+	 * still draining and will find this descriptor. The barrier orders the tail store
+	 * against the head load and pairs with set_current_state() in wait_event: either
+	 * we see the consumer caught up with us, or it sees the new tail before sleeping.
+	 */
+	smp_mb();
+	return READ_ONCE(ring->head) == tail;
+}
+
+/*
+ * Busy-poll the ring for up to the current poll window before the HW emulation thread
+ * goes to sleep. Like NAPI the window adapts: it doubles, up to hwemu_poll_us, every
+ * time work shows up while polling and halves, down to 1/16th of it, every time the
+ * window expires without work. Returns true if work is pending.
+ */
+static bool sched_test_hwemu_poll(struct sched_test_hwemu *arg)
+{
+	const u64 max_ns = (u64)READ_ONCE(hwemu_poll_us) * NSEC_PER_USEC;
+	const u64 start = local_clock();
+	u64 now = start;
+	bool found;
+
+	if (!max_ns)
+		return false;
+	if (!arg->poll_ns || (arg->poll_ns > max_ns))
+		arg->poll_ns = max_ns;
+
+	while (!(found = sched_test_ring_pending(&arg->ring)) && !kthread_should_stop()) {
+		if (now - start >= arg->poll_ns)
+			break;
+		if (need_resched())
+			cond_resched();
+		else
+			cpu_relax();
+		now = local_clock();
+	}
+
+	arg->poll_time_ns += now - start;
+	if (found) {
+		arg->poll_hits++;
+		arg->poll_ns = min(arg->poll_ns * 2, max_ns);
+	} else {
+		arg->poll_misses++;
+		arg->poll_ns = max(arg->poll_ns / 2, max_ns >> 4);
+	}
+	return found;
 }
 
 /*
@@ -153,48 +442,112 @@ static int sched_test_thread(void *data)
 	struct sched_test_hwemu *arg = data;
 
 	while (!kthread_should_stop()) {
-		int ret = 0;
-		struct event *e = NULL;
-		wait_event_interruptible(arg->wq, ((e = dequeue_next_event(arg)) ||
-						   kthread_should_stop()));
-		if (e->stop) {
-			drm_info(&arg->dev->drm, "HW breaking out of kthread loop");
-			break;
-		}
-		ret = dma_fence_signal(e->job->irq_fence);
-		arg->count++;
+		u64 next_due_ns;
+
+		/* With the hrtimer backend the thread idles until the queue switches back */
+		if ((READ_ONCE(arg->backend) != SCHED_TEST_BACKEND_KTHREAD) ||
+		    !sched_test_hwemu_poll(arg))
+			wait_event_interruptible(arg->wq, ((sched_test_ring_pending(&arg->ring) &&
+							    (READ_ONCE(arg->backend) == SCHED_TEST_BACKEND_KTHREAD)) ||
+							   kthread_should_stop()));
+		retire_pending_events(arg, &next_due_ns);
+		if (next_due_ns)
+			sched_test_hwemu_wait_until(arg, next_due_ns);
 	}
+	drm_info(&arg->dev->drm, "HW breaking out of kthread loop");
 	return 0;
 }
 
 
+/* A thread can be pinned to an online CPU, or float with -1 */
+static bool sched_test_cpu_valid(int cpu)
+{
+	return (cpu == -1) || ((cpu >= 0) && (cpu < nr_cpu_ids) && cpu_online(cpu));
+}
+
+/* Pin a thread to cpu, or let it float with -1 */
+static int sched_test_pin_thread(struct task_struct *task, int cpu)
+{
+	if (cpu < 0)
+		return set_cpus_allowed_ptr(task, cpu_possible_mask);
+	if (!sched_test_cpu_valid(cpu))
+		return -EINVAL;
+	return set_cpus_allowed_ptr(task, cpumask_of(cpu));
+}
+
+/*
+ * Moves the HW emulation thread and the drm_sched thread of a queue, both or neither.
+ * The HW emulation state stays on the node it was allocated on at load time, see
+ * hwemu_cpus.
+ */
+int sched_test_hwemu_set_affinity(struct sched_test_device *sdev, enum sched_test_queue qu,
+				  int hwemu_cpu, int sched_cpu)
+{
+	struct sched_test_hwemu *arg = sdev->hwemu[qu];
+	int ret;
+
+	if (!sched_test_cpu_valid(hwemu_cpu) || !sched_test_cpu_valid(sched_cpu))
+		return -EINVAL;
+	ret = sched_test_pin_thread(arg->hwemu_thread, hwemu_cpu);
+	if (ret)
+		return ret;
+	ret = sched_test_pin_thread(sdev->queue[qu].sched.thread, sched_cpu);
+	if (ret) {
+		/* The CPU went offline meanwhile, put the HW emulation thread back */
+		sched_test_pin_thread(arg->hwemu_thread, arg->cpu);
+		return ret;
+	}
+	/* Read locklessly by debugfs */
+	WRITE_ONCE(arg->cpu, hwemu_cpu);
+	WRITE_ONCE(arg->sched_cpu, sched_cpu);
+	return 0;
+}
+
 static int sched_test_hwemu_thread_start(struct sched_test_device *sdev, enum sched_test_queue qu)
 {
-	struct sched_test_hwemu *arg = kzalloc(sizeof(struct sched_test_hwemu), GFP_KERNEL);
+	int cpu = hwemu_cpus[qu];
+	struct sched_test_hwemu *arg;
+	int node = NUMA_NO_NODE;
 	int err = 0;
 
+	if ((cpu >= 0) && ((cpu >= nr_cpu_ids) || !cpu_online(cpu))) {
+		drm_warn(&sdev->drm, "CPU %d for HW_TSTQ_%s is not online, not pinning", cpu,
+			 sdev->queue[qu].tag);
+		cpu = -1;
+	}
+	/* The ring is embedded, so the descriptors the thread polls are node local too */
+	if (cpu >= 0)
+		node = cpu_to_node(cpu);
+	arg = kzalloc_node(sizeof(struct sched_test_hwemu), GFP_KERNEL, node);
 	if (!arg)
 		return -ENOMEM;
 	sdev->hwemu[qu] = arg;
 
 	arg->dev = sdev;
 	arg->qu = qu;
+	arg->cpu = -1;
+	arg->sched_cpu = -1;
 
 	init_waitqueue_head(&arg->wq);
-	spin_lock_init(&arg->events_lock);
 	spin_lock_init(&arg->job_lock);
-	INIT_LIST_HEAD(&arg->events_list);
-	arg->hwemu_thread = kthread_run(sched_test_thread, arg, sched_test_hw_queue_name(arg->qu));
+	hrtimer_init(&arg->timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+	arg->timer.function = sched_test_hwemu_timer;
+	init_irq_work(&arg->kick_work, sched_test_hwemu_kick_work);
+	arg->hwemu_thread = kthread_create_on_node(sched_test_thread, arg, node, "HW_TSTQ_%s",
+						   sdev->queue[qu].tag);
 
-	drm_info(&sdev->drm, "HW emulation thread start %s %p", sched_test_queue_name(qu),
+	drm_info(&sdev->drm, "HW emulation thread start %s %p", sched_test_queue_name(sdev, qu),
 		 sdev->hwemu[qu]->hwemu_thread);
 	if(IS_ERR(arg->hwemu_thread)) {
-		drm_err(&sdev->drm, "create %s", sched_test_hw_queue_name(arg->qu));
+		drm_err(&sdev->drm, "create HW_TSTQ_%s", sdev->queue[qu].tag);
 		err = PTR_ERR(arg->hwemu_thread);
 		arg->hwemu_thread = NULL;
 		goto out_free;
 	}
-	drm_info(&sdev->drm, "HW emulation queue %s", sched_test_queue_name(arg->qu));
+	if ((cpu >= 0) && !sched_test_pin_thread(arg->hwemu_thread, cpu))
+		arg->cpu = cpu;
+	wake_up_process(arg->hwemu_thread);
+	drm_info(&sdev->drm, "HW emulation queue %s", sched_test_queue_name(sdev, arg->qu));
 	return 0;
 out_free:
 	kfree(arg);
@@ -204,20 +557,22 @@ out_free:
 
 static int sched_test_hwemu_thread_stop(struct sched_test_device *sdev, enum sched_test_queue qu)
 {
-	struct event *e;
 	int ret;
 
-	drm_info(&sdev->drm, "HW emulation thread stop request %s %p", sched_test_queue_name(qu),
+	if (!sdev->hwemu[qu])
+		return 0;
+	drm_info(&sdev->drm, "HW emulation thread stop request %s %p", sched_test_queue_name(sdev, qu),
 		 sdev->hwemu[qu]->hwemu_thread);
 	if (!sdev->hwemu[qu]->hwemu_thread)
 		return 0;
 
-	e = kzalloc(sizeof(struct event), GFP_KERNEL);
-	e->stop = true;
-	enqueue_next_event(e, sdev->hwemu[qu]);
+	/* A kick deferred by the bypass FIFO may still be pending */
+	irq_work_sync(&sdev->hwemu[qu]->kick_work);
+	/* kthread_stop() wakes up the thread which then sees kthread_should_stop() */
 	ret = kthread_stop(sdev->hwemu[qu]->hwemu_thread);
 	sdev->hwemu[qu]->hwemu_thread = NULL;
-	drm_info(&sdev->drm, "HW emulation thread %s stopped, processed %ld jobs", sched_test_hw_queue_name(qu),
+	hrtimer_cancel(&sdev->hwemu[qu]->timer);
+	drm_info(&sdev->drm, "HW emulation thread HW_TSTQ_%s stopped, processed %ld jobs", sdev->queue[qu].tag,
 		 sdev->hwemu[qu]->count);
 	kfree(sdev->hwemu[qu]);
 	sdev->hwemu[qu] = NULL;
@@ -226,33 +581,76 @@ static int sched_test_hwemu_thread_stop(struct sched_test_device *sdev, enum sch
 
 int sched_test_hwemu_threads_start(struct sched_test_device *sdev)
 {
-	int result = sched_test_hwemu_thread_start(sdev, SCHED_TSTQ_A);
-	if (result)
-		return result;
-	result = sched_test_hwemu_thread_start(sdev, SCHED_TSTQ_B);
-	if (result)
-		sched_test_hwemu_thread_stop(sdev, SCHED_TSTQ_A);
-	return result;
+	enum sched_test_queue qu;
+	int result;
+
+	for (qu = SCHED_TSTQ_A; qu < sdev->num_queues; qu++) {
+		result = sched_test_hwemu_thread_start(sdev, qu);
+		if (result) {
+			sched_test_hwemu_threads_stop(sdev);
+			return result;
+		}
+	}
+	return 0;
 }
 
 int sched_test_hwemu_threads_stop(struct sched_test_device *sdev)
 {
 	enum sched_test_queue i;
-	for (i = SCHED_TSTQ_MAX; i > 0;) {
+	for (i = sdev->num_queues; i > 0;) {
 		sched_test_hwemu_thread_stop(sdev, --i);
 	}
 	return 0;
 }
 
-int sched_test_job_init(struct sched_test_job *job, struct sched_test_file_priv *priv)
+struct sched_test_job *sched_test_job_alloc(struct sched_test_device *sdev)
+{
+	struct sched_test_job *job = kmem_cache_zalloc(sdev->job_cache, GFP_KERNEL);
+
+	if (!job)
+		return NULL;
+	job->sdev = sdev;
+	atomic64_inc(&sdev->job_allocs);
+	return job;
+}
+
+/*
+ * Returns the job memory to the slab cache. Only to be called directly for a job whose
+ * irq_fence was never initialized, otherwise sched_test_fence_release() does it.
+ */
+void sched_test_job_destroy(struct sched_test_job *job)
+{
+	struct sched_test_device *sdev = job->sdev;
+
+	kmem_cache_free(sdev->job_cache, job);
+	atomic64_inc(&sdev->job_frees);
+}
+
+/*
+ * Initializes a job for entity. Its dependencies are added next and the job is only
+ * armed, with sched_test_job_arm(), right before it is pushed; until then it is undone
+ * with sched_test_job_abort().
+ */
+int sched_test_job_init(struct sched_test_job *job, struct drm_sched_entity *entity)
 {
-	int err = drm_sched_job_init(&job->base, &priv->entity[job->qu], NULL);
+	return drm_sched_job_init(&job->base, entity, NULL);
+}
 
-	if (err)
-		return err;
+/*
+ * Arms the job once nothing can fail anymore: the scheduler fences are initialized and
+ * must signal, so the job has to be pushed next. Bypass jobs have nothing to arm.
+ */
+void sched_test_job_arm(struct sched_test_job *job)
+{
+	if (job->bypass)
+		return;
 
-	job->sdev = priv->sdev;
+	/*
+	 * Arming picks the scheduler; for an entity spanning several queues that is the
+	 * least loaded one, so only now do we know which queue the job runs on
+	 */
 	drm_sched_job_arm(&job->base);
+	job->qu = to_sched_test_queue(job->sdev, job->base.sched);
 //	DRM_INFO("job %p done_fence %p refcount %d -- A", job, &job->base.s_fence->finished,
 //		 kref_read(&job->base.s_fence->finished.refcount));
 	/*
@@ -260,22 +658,269 @@ int sched_test_job_init(struct sched_test_job *job, struct sched_test_file_priv
 	 * if/when the client process waits for the job completion
 	 */
 	job->done_fence = dma_fence_get(&job->base.s_fence->finished);
-	drm_info(&priv->sdev->drm, "After done_fence...");
 //	DRM_INFO("job %p done_fence %p refcount %d -- B", job, job->done_fence,
 //		 kref_read(&job->done_fence->refcount));
 //	drm_sched_entity_push_job(&job->base, &priv->entity[job->qu]);
 	//drm_sched_entity_push_job(&job->base);
-	drm_info(&priv->sdev->drm, "Done job init...");
-	return err;
+}
+
+/*
+ * Hands a job whose irq fence is initialized to the emulated HW of its queue. Called by
+ * the queue's scheduler thread from run_job, or under the bypass FIFO lock, so there is
+ * a single producer to the ring at any time. Returns true if the emulated HW needs a
+ * kick, see enqueue_next_event().
+ */
+static bool sched_test_job_to_hw(struct sched_test_job *job)
+{
+	job->event.job = job;
+	job->event.queued_ns = ktime_get_ns();
+	sched_test_stat_inc(job->sdev, job->qu, SCHED_TEST_STAT_RUN);
+	trace_sched_test_run(job);
+	sched_test_lat_record(job->sdev, job->qu, SCHED_TEST_LAT_SUBMIT_RUN, job->submit_ns,
+			      job->event.queued_ns);
+	return enqueue_next_event(&job->event, job->sdev->hwemu[job->qu]);
+}
+
+/*
+ * Initializes a job of a bypass queue. There is no scheduler finished fence, the irq
+ * fence is the done fence and exists from the start. Every bypass job gets a fence
+ * context of its own: the jobs of a queue are pushed from any number of threads, so
+ * their order is only known once they are in the FIFO, after the fence is visible.
+ */
+int sched_test_bypass_job_init(struct sched_test_job *job, enum sched_test_queue qu)
+{
+	struct sched_test_device *sdev = job->sdev;
+
+	job->bypass = true;
+	job->qu = qu;
+	job->irq_fence.sdev = sdev;
+	job->irq_fence.qu = qu;
+	job->irq_fence.seqno = 1;
+	/* The initial reference is held by the job, like the one run_job takes */
+	dma_fence_init(&job->irq_fence.base, &sched_test_fence_ops, &sdev->hwemu[qu]->job_lock,
+		       dma_fence_context_alloc(1), job->irq_fence.seqno);
+	job->done_fence = dma_fence_get(&job->irq_fence.base);
+	return 0;
+}
+
+/* Adds a dependency to the job, consuming the fence reference also on failure */
+int sched_test_job_add_dependency(struct sched_test_job *job, struct dma_fence *fence)
+{
+	struct sched_test_bypass_dep *deps;
+	u32 max_deps;
+
+	if (!job->bypass)
+		return drm_sched_job_add_dependency(&job->base, fence);
+
+	if (job->bypass_num_deps == job->bypass_max_deps) {
+		max_deps = max(job->bypass_max_deps * 2, 4U);
+		deps = krealloc_array(job->bypass_deps, max_deps, sizeof(*deps), GFP_KERNEL);
+		if (!deps) {
+			dma_fence_put(fence);
+			return -ENOMEM;
+		}
+		job->bypass_deps = deps;
+		job->bypass_max_deps = max_deps;
+	}
+	job->bypass_deps[job->bypass_num_deps].fence = fence;
+	job->bypass_deps[job->bypass_num_deps].job = job;
+	job->bypass_num_deps++;
+	return 0;
+}
+
+static void sched_test_bypass_put_deps(struct sched_test_job *job)
+{
+	u32 i;
+
+	for (i = 0; i < job->bypass_num_deps; i++)
+		dma_fence_put(job->bypass_deps[i].fence);
+	kfree(job->bypass_deps);
+	job->bypass_deps = NULL;
+	job->bypass_num_deps = 0;
+}
+
+/*
+ * Hands the ready jobs at the head of the FIFO to the emulated HW while there is room,
+ * called with the FIFO lock held. Returns true if the emulated HW needs a kick, which
+ * the caller does once it dropped the lock.
+ */
+static bool sched_test_bypass_dispatch_locked(struct sched_test_bypass *bypass)
+{
+	struct sched_test_job *job;
+	bool kick = false;
+
+	while (bypass->in_flight < SCHED_TEST_HW_JOBS_LIMIT) {
+		job = list_first_entry_or_null(&bypass->fifo, struct sched_test_job, bypass_link);
+		if (!job || atomic_read(&job->bypass_pending))
+			break;
+		list_del(&job->bypass_link);
+		bypass->in_flight++;
+		/* Like drm_sched the job still goes through the HW, carrying the error */
+		if (job->bypass_error)
+			dma_fence_set_error(&job->irq_fence.base, job->bypass_error);
+		kick |= sched_test_job_to_hw(job);
+	}
+	return kick;
+}
+
+/*
+ * One more dependency of the job signaled, the job is ready once none is left. Returns
+ * true if the emulated HW needs a kick.
+ */
+static bool sched_test_bypass_dep_done(struct sched_test_job *job, struct dma_fence *fence)
+{
+	struct sched_test_bypass *bypass = &job->sdev->queue[job->qu].bypass_fifo;
+	unsigned long flags;
+	bool kick;
+
+	if (fence && fence->error)
+		cmpxchg(&job->bypass_error, 0, fence->error);
+	if (!atomic_dec_and_test(&job->bypass_pending))
+		return false;
+	spin_lock_irqsave(&bypass->lock, flags);
+	kick = sched_test_bypass_dispatch_locked(bypass);
+	spin_unlock_irqrestore(&bypass->lock, flags);
+	return kick;
+}
+
+/*
+ * Runs under the lock of the signaling fence, possibly the job_lock of another queue
+ * which the kick must not nest in, so the kick is deferred to an irq_work
+ */
+static void sched_test_bypass_dep_signaled(struct dma_fence *fence, struct dma_fence_cb *cb)
+{
+	struct sched_test_bypass_dep *dep = container_of(cb, struct sched_test_bypass_dep, cb);
+	/* The job may complete and be freed as soon as it is dispatched */
+	struct sched_test_hwemu *arg = dep->job->sdev->hwemu[dep->job->qu];
+
+	if (sched_test_bypass_dep_done(dep->job, fence))
+		irq_work_queue(&arg->kick_work);
+}
+
+/*
+ * The irq fence of a bypass job signaled: this stands in for free_job and runs under
+ * the queue's job_lock, from the HW emulation thread or the hrtimer interrupt. Dropping
+ * the job's last reference only frees it after a RCU grace period.
+ */
+static void sched_test_bypass_job_done(struct dma_fence *fence, struct dma_fence_cb *cb)
+{
+	struct sched_test_job *job = container_of(cb, struct sched_test_job, bypass_done_cb);
+	struct sched_test_bypass *bypass = &job->sdev->queue[job->qu].bypass_fifo;
+	struct sched_test_hwemu *arg = job->sdev->hwemu[job->qu];
+	unsigned long flags;
+	bool kick;
+
+	sched_test_stat_inc(job->sdev, job->qu, SCHED_TEST_STAT_FREED);
+	trace_sched_test_free(job);
+	sched_test_lat_record(job->sdev, job->qu, SCHED_TEST_LAT_SIGNAL_FREE, job->signal_ns,
+			      ktime_get_ns());
+	sched_test_bypass_put_deps(job);
+
+	spin_lock_irqsave(&bypass->lock, flags);
+	bypass->in_flight--;
+	kick = sched_test_bypass_dispatch_locked(bypass);
+	if (!bypass->in_flight && list_empty(&bypass->fifo))
+		wake_up(&bypass->idle);
+	spin_unlock_irqrestore(&bypass->lock, flags);
+	/* We run under job_lock, see sched_test_bypass_dep_signaled() */
+	if (kick)
+		irq_work_queue(&arg->kick_work);
+
+	sched_test_job_fini(job);
+	dma_fence_put(&job->irq_fence.base);
+}
+
+/*
+ * Queues a bypass job and installs the callbacks on its dependencies. bypass_pending
+ * starts one above the number of dependencies so the job cannot become ready, and be
+ * dispatched, before all the callbacks are in place.
+ */
+static void sched_test_bypass_push(struct sched_test_job *job)
+{
+	struct sched_test_bypass *bypass = &job->sdev->queue[job->qu].bypass_fifo;
+	struct sched_test_hwemu *arg = job->sdev->hwemu[job->qu];
+	struct sched_test_bypass_dep *dep;
+	unsigned long flags;
+	bool kick = false;
+	u32 i;
+
+	/* The job cannot signal before it reaches the emulated HW, so this cannot fail */
+	dma_fence_add_callback(&job->irq_fence.base, &job->bypass_done_cb, sched_test_bypass_job_done);
+	atomic_set(&job->bypass_pending, job->bypass_num_deps + 1);
+
+	spin_lock_irqsave(&bypass->lock, flags);
+	list_add_tail(&job->bypass_link, &bypass->fifo);
+	spin_unlock_irqrestore(&bypass->lock, flags);
+
+	for (i = 0; i < job->bypass_num_deps; i++) {
+		dep = &job->bypass_deps[i];
+		if (dma_fence_add_callback(dep->fence, &dep->cb, sched_test_bypass_dep_signaled))
+			kick |= sched_test_bypass_dep_done(job, dep->fence);
+	}
+	kick |= sched_test_bypass_dep_done(job, NULL);
+	/* No lock held here, kick the emulated HW right away */
+	if (kick)
+		sched_test_hwemu_kick(arg);
+}
+
+/* Waits for the bypass FIFOs to run dry, before the emulated HW goes away */
+void sched_test_bypass_drain(struct sched_test_device *sdev)
+{
+	enum sched_test_queue qu;
+
+	for (qu = SCHED_TSTQ_A; qu < sdev->num_queues; qu++) {
+		struct sched_test_bypass *bypass = &sdev->queue[qu].bypass_fifo;
+
+		if (!sdev->queue[qu].bypass)
+			continue;
+		wait_event(bypass->idle, ({
+			bool idle;
+
+			spin_lock_irq(&bypass->lock);
+			idle = !bypass->in_flight && list_empty(&bypass->fifo);
+			spin_unlock_irq(&bypass->lock);
+			idle;
+		}));
+	}
+}
+
+/*
+ * Undoes sched_test_job_init() or sched_test_bypass_job_init() of a job which was never
+ * armed and frees it
+ */
+void sched_test_job_abort(struct sched_test_job *job)
+{
+	if (job->bypass) {
+		sched_test_bypass_put_deps(job);
+		sched_test_job_fini(job);
+		dma_fence_put(&job->irq_fence.base);
+		return;
+	}
+	drm_sched_job_cleanup(&job->base);
+	sched_test_job_fini(job);
+	sched_test_job_destroy(job);
+}
+
+/*
+ * Hands an armed job over to the scheduler. The job may run, complete and be freed
+ * before this returns.
+ */
+void sched_test_job_push(struct sched_test_job *job)
+{
+	job->submit_ns = ktime_get_ns();
+	sched_test_stat_inc(job->sdev, job->qu, SCHED_TEST_STAT_SUBMITTED);
+	trace_sched_test_push(job);
+	if (job->bypass)
+		sched_test_bypass_push(job);
+	else
+		drm_sched_entity_push_job(&job->base);
 }
 
 void sched_test_job_fini(struct sched_test_job *job)
 {
-//	dma_fence_put(job->in_fence);
 //	DRM_INFO("job %p done_fence %p refcount %d -- C", job, job->done_fence,
 //		 kref_read(&job->done_fence->refcount));
 	dma_fence_put(job->done_fence);
-	drm_info(&job->sdev->drm, "Done job fini...");
 }
 
 /*
@@ -289,35 +934,58 @@ static struct dma_fence *sched_test_job_dependency(struct drm_sched_job *sched_j
 }
 */
 
+/*
+ * Runs on the scheduler thread, everything needed is already part of the job so
+ * there is nothing to allocate and nothing which can fail here.
+ */
 static struct dma_fence *sched_test_job_run(struct drm_sched_job *sched_job)
 {
 	struct sched_test_job *job = to_sched_test_job(sched_job);
 	struct dma_fence *irq_fence = NULL;
-	struct event *e = NULL;
 
 	if (unlikely(job->base.s_fence->finished.error))
 		return NULL;
 
-	e = kzalloc(sizeof(struct event), GFP_KERNEL);
-	if (!e)
-		return NULL;
-	/* Creates the fence and also adds a reference for our use */
-	irq_fence = sched_test_fence_create(job->sdev, job->qu);
-	if (IS_ERR(irq_fence))
-		goto out_free;
+	/* Initializes the fence, the initial reference is held by the job */
+	irq_fence = sched_test_fence_init(&job->irq_fence, job->sdev, job->qu);
 
 	/* Get another reference for the scheduler thread */
-	job->irq_fence = dma_fence_get(irq_fence);
-	e->job = job;
-	e->stop = false;
-	enqueue_next_event(e, job->sdev->hwemu[job->qu]);
+	dma_fence_get(irq_fence);
+	if (sched_test_job_to_hw(job))
+		sched_test_hwemu_kick(job->sdev->hwemu[job->qu]);
 //	DRM_INFO("job %p done_fence %p refcount %d -- D", job, job->done_fence,
 //		 kref_read(&job->done_fence->refcount));
-	return job->irq_fence;
+	return irq_fence;
+}
 
-out_free:
-	kfree(e);
-	return NULL;
+/*
+ * run_job of the fast queue: the job completes inline on the scheduler thread, there is
+ * no handoff to the emulated HW thread and run_job returns an already signaled fence.
+ * The queue's service time model does not apply. Comparing against the regular queue
+ * gives the cost of the kthread round trip apart from drm_sched's own overhead.
+ */
+static struct dma_fence *sched_test_job_run_fast(struct drm_sched_job *sched_job)
+{
+	struct sched_test_job *job = to_sched_test_job(sched_job);
+	struct dma_fence *irq_fence = NULL;
+
+	if (unlikely(job->base.s_fence->finished.error))
+		return NULL;
+
+	irq_fence = sched_test_fence_init(&job->irq_fence, job->sdev, job->qu);
+	dma_fence_get(irq_fence);
+	job->event.queued_ns = ktime_get_ns();
+	job->signal_ns = job->event.queued_ns;
+	sched_test_stat_inc(job->sdev, job->qu, SCHED_TEST_STAT_RUN);
+	sched_test_lat_record(job->sdev, job->qu, SCHED_TEST_LAT_SUBMIT_RUN, job->submit_ns,
+			      job->event.queued_ns);
+	trace_sched_test_run(job);
+	sched_test_stat_inc(job->sdev, job->qu, SCHED_TEST_STAT_SIGNALED);
+	sched_test_lat_record(job->sdev, job->qu, SCHED_TEST_LAT_RUN_SIGNAL, job->signal_ns,
+			      job->signal_ns);
+	trace_sched_test_signal(job);
+	dma_fence_signal(irq_fence);
+	return irq_fence;
 }
 
 static enum drm_gpu_sched_stat sched_test_job_timedout(struct drm_sched_job *sched_job)
@@ -330,12 +998,21 @@ static void sched_test_job_free(struct drm_sched_job *sched_job)
 {
 	struct sched_test_job *job = to_sched_test_job(sched_job);
 
-	/* Done with the irq_fence, release it */
-	dma_fence_put(job->irq_fence);
-	job->irq_fence = NULL;
+	sched_test_stat_inc(job->sdev, job->qu, SCHED_TEST_STAT_FREED);
+	trace_sched_test_free(job);
+	if (job->signal_ns)
+		sched_test_lat_record(job->sdev, job->qu, SCHED_TEST_LAT_SIGNAL_FREE, job->signal_ns,
+				      ktime_get_ns());
 	drm_sched_job_cleanup(sched_job);
 	sched_test_job_fini(job);
-	kfree(job);
+	/*
+	 * Done with the irq_fence, release it. This also frees the job once the scheduler
+	 * drops its reference. If run_job never initialized the fence free the job here.
+	 */
+	if (job->irq_fence.base.ops)
+		dma_fence_put(&job->irq_fence.base);
+	else
+		sched_test_job_destroy(job);
 }
 
 static const struct drm_sched_backend_ops sched_test_regular_ops = {
@@ -345,39 +1022,86 @@ static const struct drm_sched_backend_ops sched_test_regular_ops = {
 };
 
 static const struct drm_sched_backend_ops sched_test_fast_ops = {
-	.run_job = sched_test_job_run,
+	.run_job = sched_test_job_run_fast,
 	.timedout_job = sched_test_job_timedout,
 	.free_job = sched_test_job_free,
 };
 
 int sched_test_sched_init(struct sched_test_device *sdev)
 {
-	int hw_jobs_limit = 16;
+	int hw_jobs_limit = SCHED_TEST_HW_JOBS_LIMIT;
 	int job_hang_limit = 0;
 	int hang_limit_ms = 500;
+	enum sched_test_queue qu;
+	u64 fence_context;
 	int ret;
 
-	ret = drm_sched_init(&sdev->queue[SCHED_TSTQ_A].sched,
-			     &sched_test_regular_ops,
-			     hw_jobs_limit, job_hang_limit,
-			     msecs_to_jiffies(hang_limit_ms),
-			     NULL, NULL, sched_test_queue_name(SCHED_TSTQ_A), sdev->drm.dev);
-	if (ret) {
-		drm_err(&sdev->drm, "Failed to create %s scheduler: %d", sched_test_queue_name(SCHED_TSTQ_A), ret);
-		return ret;
+	/*
+	 * The emulated HW ring must be able to hold every job the scheduler puts in flight.
+	 * retire_pending_events() publishes head only after a whole batch is retired, while
+	 * each fence it signals frees a credit right away, so up to SCHED_TEST_HW_JOBS_LIMIT
+	 * new jobs can be queued behind a batch whose slots are still taken.
+	 */
+	BUILD_BUG_ON(2 * SCHED_TEST_HW_JOBS_LIMIT > SCHED_TEST_RING_SIZE);
+
+	sdev->job_cache = KMEM_CACHE(sched_test_job, SLAB_HWCACHE_ALIGN);
+	if (!sdev->job_cache)
+		return -ENOMEM;
+
+	fence_context = dma_fence_context_alloc(sdev->num_queues);
+	for (qu = SCHED_TSTQ_A; qu < sdev->num_queues; qu++) {
+		struct sched_test_queue_state *queue = &sdev->queue[qu];
+		/* Queue B is the "fast" queue */
+		const struct drm_sched_backend_ops *ops = (qu == SCHED_TSTQ_B) ?
+			&sched_test_fast_ops : &sched_test_regular_ops;
+
+		if (qu < 26)
+			snprintf(queue->tag, sizeof(queue->tag), "%c", 'A' + qu);
+		else
+			snprintf(queue->tag, sizeof(queue->tag), "%u", qu);
+		snprintf(queue->name, sizeof(queue->name), "SCHED_TSTQ_%s", queue->tag);
+		queue->fence_context = fence_context + qu;
+		spin_lock_init(&queue->bypass_fifo.lock);
+		INIT_LIST_HEAD(&queue->bypass_fifo.fifo);
+		init_waitqueue_head(&queue->bypass_fifo.idle);
+		if ((qu < BITS_PER_LONG) && (bypass_queues & BIT(qu))) {
+			if (qu == SCHED_TSTQ_B)
+				drm_warn(&sdev->drm, "The fast queue %s cannot bypass drm_sched", queue->name);
+			else
+				queue->bypass = true;
+		}
+		queue->stats = alloc_percpu(struct sched_test_queue_stats);
+		if (!queue->stats) {
+			sched_test_sched_fini(sdev);
+			return -ENOMEM;
+		}
+
+		ret = drm_sched_init(&queue->sched, ops,
+				     hw_jobs_limit, job_hang_limit,
+				     msecs_to_jiffies(hang_limit_ms),
+				     NULL, NULL, queue->name, sdev->drm.dev);
+		if (ret) {
+			drm_err(&sdev->drm, "Failed to create %s scheduler: %d", queue->name, ret);
+			sched_test_sched_fini(sdev);
+			return ret;
+		}
 	}
 
-	ret = drm_sched_init(&sdev->queue[SCHED_TSTQ_B].sched,
-			     &sched_test_fast_ops,
-			     hw_jobs_limit, job_hang_limit,
-			     msecs_to_jiffies(hang_limit_ms),
-			     NULL, NULL, sched_test_queue_name(SCHED_TSTQ_B), sdev->drm.dev);
-	if (ret) {
-		drm_err(&sdev->drm, "Failed to create %s scheduler: %d", sched_test_queue_name(SCHED_TSTQ_B),
-			ret);
+	/*
+	 * Every queue but the fast one is equivalent for load balancing, leaving out the
+	 * bypass queues whose ring must only be fed by their bypass FIFO
+	 */
+	sdev->balance_list = kcalloc(sdev->num_queues, sizeof(*sdev->balance_list), GFP_KERNEL);
+	if (!sdev->balance_list) {
 		sched_test_sched_fini(sdev);
-		return ret;
+		return -ENOMEM;
+	}
+	for (qu = SCHED_TSTQ_A; qu < sdev->num_queues; qu++) {
+		if ((qu != SCHED_TSTQ_B) && !sdev->queue[qu].bypass)
+			sdev->balance_list[sdev->num_balance++] = &sdev->queue[qu].sched;
 	}
+	if (!sdev->num_balance)
+		drm_warn(&sdev->drm, "No queue left to balance over, balanced submissions fail with -ENODEV");
 
 	return 0;
 }
@@ -385,8 +1109,23 @@ int sched_test_sched_init(struct sched_test_device *sdev)
 void sched_test_sched_fini(struct sched_test_device *sdev)
 {
 	enum sched_test_queue i;
-	for (i = SCHED_TSTQ_MAX; i > 0;) {
+
+	kfree(sdev->balance_list);
+	sdev->balance_list = NULL;
+	sdev->num_balance = 0;
+	for (i = sdev->num_queues; i > 0;) {
 		if (sdev->queue[--i].sched.ready)
 			drm_sched_fini(&sdev->queue[i].sched);
+		free_percpu(sdev->queue[i].stats);
+		sdev->queue[i].stats = NULL;
 	}
+
+	if (!sdev->job_cache)
+		return;
+	/* Wait for the RCU deferred frees from sched_test_fence_release() */
+	rcu_barrier();
+	drm_info(&sdev->drm, "Job cache %lld allocs, %lld frees", atomic64_read(&sdev->job_allocs),
+		 atomic64_read(&sdev->job_frees));
+	kmem_cache_destroy(sdev->job_cache);
+	sdev->job_cache = NULL;
 }
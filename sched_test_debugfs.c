@@ -0,0 +1,140 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Copyright (C) 2022-2023 Advanced Micro Devices, Inc.
+ * Authors:
+ *     Sonal Santan <sonal.santan@amd.com>
+ */
+
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>
+#include <linux/percpu.h>
+
+#include <drm/drm_device.h>
+#include <drm/drm_file.h>
+#include <drm/drm_debugfs.h>
+
+#include "sched_test_common.h"
+
+/*
+ * Job object memory: every submitted job is a single object from the job cache, the
+ * IRQ fence and the HW emulation event live inside it
+ */
+static int sched_test_slab_show(struct seq_file *m, void *unused)
+{
+	struct sched_test_device *sdev = m->private;
+	const s64 allocs = atomic64_read(&sdev->job_allocs);
+	const s64 frees = atomic64_read(&sdev->job_frees);
+	const unsigned int size = kmem_cache_size(sdev->job_cache);
+
+	seq_printf(m, "job_object_size: %u\n", size);
+	seq_printf(m, "job_allocs: %lld\n", allocs);
+	seq_printf(m, "job_frees: %lld\n", frees);
+	seq_printf(m, "job_live: %lld\n", allocs - frees);
+	seq_printf(m, "job_live_bytes: %lld\n", (allocs - frees) * size);
+	return 0;
+}
+
+DEFINE_SHOW_ATTRIBUTE(sched_test_slab);
+
+/*
+ * Emulated HW activity: how many jobs each wakeup of the HW emulation thread, or each
+ * interrupt of the hrtimer backend, retired with a single job_lock acquisition and how
+ * much time the thread spent busy-polling
+ */
+static int sched_test_hwemu_show(struct seq_file *m, void *unused)
+{
+	const struct sched_test_hwemu *arg = m->private;
+	int i;
+
+	seq_printf(m, "jobs: %lu\n", READ_ONCE(arg->count));
+	seq_printf(m, "wakeups: %lu\n", READ_ONCE(arg->wakeups));
+	seq_puts(m, "batch_size_histogram:\n");
+	for (i = 0; i < SCHED_TEST_BATCH_HIST_BUCKETS; i++)
+		seq_printf(m, "  %4u-%-4u: %lu\n", 1U << i, (2U << i) - 1, READ_ONCE(arg->batch_hist[i]));
+	seq_printf(m, "service_model: %u %llu %llu %u\n", READ_ONCE(arg->service.model),
+		   READ_ONCE(arg->service.param0_ns), READ_ONCE(arg->service.param1_ns),
+		   READ_ONCE(arg->service.permille));
+	seq_printf(m, "cpu: %d\n", READ_ONCE(arg->cpu));
+	seq_printf(m, "sched_cpu: %d\n", READ_ONCE(arg->sched_cpu));
+	seq_printf(m, "backend: %s\n",
+		   (READ_ONCE(arg->backend) == SCHED_TEST_BACKEND_HRTIMER) ? "hrtimer" : "kthread");
+	seq_printf(m, "poll_window_ns: %llu\n", READ_ONCE(arg->poll_ns));
+	seq_printf(m, "poll_time_ns: %llu\n", READ_ONCE(arg->poll_time_ns));
+	seq_printf(m, "poll_hits: %lu\n", READ_ONCE(arg->poll_hits));
+	seq_printf(m, "poll_misses: %lu\n", READ_ONCE(arg->poll_misses));
+	return 0;
+}
+
+DEFINE_SHOW_ATTRIBUTE(sched_test_hwemu);
+
+/*
+ * Job lifecycle of one queue: per-CPU counters and latency histograms summed over all
+ * CPUs. The sums are not a consistent snapshot, a job may be counted at one stage but
+ * not yet at the previous one, so the derived depths are clamped at 0.
+ */
+static int sched_test_stats_show(struct seq_file *m, void *unused)
+{
+	static const char *const stat_names[SCHED_TEST_STAT_MAX] = {
+		"submitted", "run", "signaled", "freed"
+	};
+	static const char *const lat_names[SCHED_TEST_LAT_MAX] = {
+		"submit_to_run", "run_to_signal", "signal_to_free"
+	};
+	const struct sched_test_queue_state *queue = m->private;
+	struct sched_test_queue_stats *sum;
+	int cpu, i, j;
+
+	sum = kzalloc(sizeof(*sum), GFP_KERNEL);
+	if (!sum)
+		return -ENOMEM;
+
+	for_each_possible_cpu(cpu) {
+		const struct sched_test_queue_stats *stats = per_cpu_ptr(queue->stats, cpu);
+
+		for (i = 0; i < SCHED_TEST_STAT_MAX; i++)
+			sum->count[i] += READ_ONCE(stats->count[i]);
+		for (i = 0; i < SCHED_TEST_LAT_MAX; i++)
+			for (j = 0; j < SCHED_TEST_LAT_HIST_BUCKETS; j++)
+				sum->lat_hist[i][j] += READ_ONCE(stats->lat_hist[i][j]);
+	}
+
+	seq_printf(m, "bypass: %s\n", queue->bypass ? "yes" : "no");
+	for (i = 0; i < SCHED_TEST_STAT_MAX; i++)
+		seq_printf(m, "%s: %llu\n", stat_names[i], sum->count[i]);
+	/* Jobs handed to the emulated HW and not yet signaled, bounded by hw_jobs_limit */
+	seq_printf(m, "hw_in_flight: %lld\n",
+		   max_t(s64, sum->count[SCHED_TEST_STAT_RUN] - sum->count[SCHED_TEST_STAT_SIGNALED], 0));
+	seq_printf(m, "hw_jobs_limit: %u\n", SCHED_TEST_HW_JOBS_LIMIT);
+	/* Jobs pushed to the scheduler, or the bypass FIFO, and not yet freed */
+	seq_printf(m, "sched_in_flight: %lld\n",
+		   max_t(s64, sum->count[SCHED_TEST_STAT_SUBMITTED] - sum->count[SCHED_TEST_STAT_FREED], 0));
+
+	for (i = 0; i < SCHED_TEST_LAT_MAX; i++) {
+		seq_printf(m, "%s_ns_histogram:\n", lat_names[i]);
+		for (j = 0; j < SCHED_TEST_LAT_HIST_BUCKETS; j++) {
+			if (sum->lat_hist[i][j])
+				seq_printf(m, "  %12llu-%-12llu: %llu\n", (j ? 1ULL << j : 0ULL),
+					   (2ULL << j) - 1, sum->lat_hist[i][j]);
+		}
+	}
+	kfree(sum);
+	return 0;
+}
+
+DEFINE_SHOW_ATTRIBUTE(sched_test_stats);
+
+void sched_test_debugfs_init(struct drm_minor *minor)
+{
+	struct sched_test_device *sdev = to_sched_test_dev(minor->dev);
+	enum sched_test_queue qu;
+
+	debugfs_create_file("slab", 0444, minor->debugfs_root, sdev, &sched_test_slab_fops);
+
+	for (qu = SCHED_TSTQ_A; qu < sdev->num_queues; qu++) {
+		struct dentry *dir = debugfs_create_dir(sched_test_queue_name(sdev, qu), minor->debugfs_root);
+
+		debugfs_create_file("hwemu", 0444, dir, sdev->hwemu[qu], &sched_test_hwemu_fops);
+		debugfs_create_file("stats", 0444, dir, &sdev->queue[qu], &sched_test_stats_fops);
+	}
+}
@@ -10,6 +10,12 @@
 #include <linux/slab.h>
 #include <linux/platform_device.h>
 #include <linux/version.h>
+#include <linux/uaccess.h>
+#include <linux/capability.h>
+#include <linux/dma-fence-chain.h>
+#include <linux/sync_file.h>
+#include <linux/file.h>
+#include <linux/sched/signal.h>
 
 #include <drm/drm_device.h>
 #include <drm/drm_file.h>
@@ -22,6 +28,7 @@
 
 
 #include "sched_test_common.h"
+#include "sched_test_trace.h"
 #include "uapi/sched_test.h"
 
 #define DRIVER_NAME	"sched_test"
@@ -32,54 +39,48 @@
 
 static struct sched_test_device *sched_test_device_obj;
 
+static const enum drm_sched_priority sched_test_priority_map[SCHED_TEST_PRIORITY_MAX] = {
+	[SCHED_TEST_PRIORITY_NORMAL] = DRM_SCHED_PRIORITY_NORMAL,
+	[SCHED_TEST_PRIORITY_LOW] = DRM_SCHED_PRIORITY_MIN,
+	[SCHED_TEST_PRIORITY_HIGH] = DRM_SCHED_PRIORITY_HIGH,
+	[SCHED_TEST_PRIORITY_KERNEL] = DRM_SCHED_PRIORITY_KERNEL,
+};
+
+static unsigned int num_queues = SCHED_TSTQ_MAX;
+module_param(num_queues, uint, 0444);
+MODULE_PARM_DESC(num_queues, "Number of HW queues, each with its own scheduler, 1 to 64 (default 2)");
+
+/*
+ * Adds the fence of syncobj in_fence as a dependency of the job. A non-zero point
+ * selects that point of a timeline syncobj, 0 the fence of a binary syncobj.
+ */
 static inline int sched_test_add_dependencies(struct sched_test_job *job, struct drm_file *file_priv,
-					      int in_fence)
+					      int in_fence, u64 point)
 {
-	struct sched_test_file_priv *priv = file_priv->driver_priv;
-	struct drm_device *dev = &priv->sdev->drm;
-	struct drm_syncobj *syncobj = NULL;
 	struct dma_fence *fence = NULL;
 	int ret = 0;
-#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 3, 0)
-	syncobj = drm_syncobj_find(file_priv, in_fence);
 
-	drm_info(dev, "<6.3.0Before add depedency fence = %d...", in_fence);
-	if (!syncobj)
-		return -ENOENT;
-
-	fence = drm_syncobj_fence_get(syncobj);
-	if (!fence) {
-		drm_syncobj_put(syncobj);
-		return -ENOENT;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 3, 0)
+	if (!job->bypass) {
+		ret = drm_sched_job_add_syncobj_dependency(&job->base, file_priv, in_fence, point);
+		trace_sched_test_add_dep(job, in_fence, point, ret);
+		return ret;
 	}
-
-	ret = drm_sched_job_add_dependency(&job->base, fence);
-
-	dma_fence_put(fence);
-	drm_syncobj_put(syncobj);
-	drm_info(dev, "After add depedency ret = %d...", ret);
-	return ret;
-
-#else
-	drm_info(dev, ">=6.3.0Before add depedency fence = %d...", in_fence);
-#if 0
-	syncobj = drm_syncobj_find(file_priv, in_fence);
-	drm_info(dev, "After find syncobj find, in_fence = %d, ret = %d, syncobj = 0x%p...", in_fence, ret, syncobj);
-	fence = drm_syncobj_fence_get(syncobj);
-	drm_info(dev, "After find syncobj fence get fence = 0x%p...", fence);
-	ret = drm_syncobj_find_fence(file_priv, in_fence, 0, 0, &fence);
-	drm_info(dev, "After find fence in_fence = %d, ret = %d, fence = 0x%p...", in_fence, ret, fence);
 #endif
-	ret = drm_sched_job_add_syncobj_dependency(&job->base, file_priv, in_fence, 0);
-	drm_info(dev, "After add depedency ret = %d...", ret);
+	ret = drm_syncobj_find_fence(file_priv, in_fence, point, 0, &fence);
+	if (!ret)
+		ret = sched_test_job_add_dependency(job, fence);
+	trace_sched_test_add_dep(job, in_fence, point, ret);
 	return ret;
-#endif
 }
 
 static int sched_test_open(struct drm_device *dev, struct drm_file *file)
 {
 	struct sched_test_file_priv *priv = NULL;
 	struct drm_gpu_scheduler *sched;
+	enum sched_test_priority prio;
+	enum sched_test_queue qu;
+	unsigned int i;
 	int ret = 0;
 
 	/* Do not allow users to open PRIMARY node, /dev/dri/cardX node.
@@ -93,24 +94,46 @@ static int sched_test_open(struct drm_device *dev, struct drm_file *file)
 		return -ENOMEM;
 
 	priv->sdev = to_sched_test_dev(dev);
-	sched = &priv->sdev->queue[SCHED_TSTQ_A].sched;
-	ret = drm_sched_entity_init(&priv->entity[SCHED_TSTQ_A], DRM_SCHED_PRIORITY_NORMAL, &sched,
-				    1, NULL);
-	if (ret)
-		goto out;
-	sched = &priv->sdev->queue[SCHED_TSTQ_B].sched;
-	ret = drm_sched_entity_init(&priv->entity[SCHED_TSTQ_B], DRM_SCHED_PRIORITY_NORMAL, &sched,
-				    1, NULL);
-	if (ret) {
-		drm_sched_entity_destroy(&priv->entity[SCHED_TSTQ_A]);
+	mutex_init(&priv->submit_lock);
+	priv->entity = kcalloc(priv->sdev->num_queues * SCHED_TEST_PRIORITY_MAX, sizeof(*priv->entity),
+			       GFP_KERNEL);
+	if (!priv->entity) {
+		ret = -ENOMEM;
 		goto out;
 	}
 
+	for (qu = SCHED_TSTQ_A; qu < priv->sdev->num_queues; qu++) {
+		sched = &priv->sdev->queue[qu].sched;
+		for (prio = SCHED_TEST_PRIORITY_NORMAL; prio < SCHED_TEST_PRIORITY_MAX; prio++) {
+			ret = drm_sched_entity_init(sched_test_entity(priv, qu, prio),
+						    sched_test_priority_map[prio], &sched, 1, NULL);
+			if (ret)
+				goto out_entity;
+		}
+	}
+
+	for (prio = SCHED_TEST_PRIORITY_NORMAL; prio < SCHED_TEST_PRIORITY_MAX; prio++) {
+		ret = drm_sched_entity_init(&priv->balanced[prio], sched_test_priority_map[prio],
+					    priv->sdev->balance_list, priv->sdev->num_balance, NULL);
+		if (ret)
+			goto out_balanced;
+	}
+
 	file->driver_priv = priv;
-	drm_info(dev, "File opened, sched entity A and B created...");
+	drm_info(dev, "File opened, %u sched entities created...",
+		 (priv->sdev->num_queues + 1) * SCHED_TEST_PRIORITY_MAX);
 	return 0;
 
+out_balanced:
+	while (prio > SCHED_TEST_PRIORITY_NORMAL)
+		drm_sched_entity_destroy(&priv->balanced[--prio]);
+out_entity:
+	/* Entities were created in (queue, priority) order, unwind them in reverse */
+	for (i = qu * SCHED_TEST_PRIORITY_MAX + prio; i > 0;)
+		drm_sched_entity_destroy(&priv->entity[--i]);
+	kfree(priv->entity);
 out:
+	mutex_destroy(&priv->submit_lock);
 	kfree(priv);
 	return ret;
 }
@@ -119,45 +142,119 @@ out:
 static void sched_test_postclose(struct drm_device *dev, struct drm_file *file)
 {
 	struct sched_test_file_priv *priv = file->driver_priv;
+	unsigned int i;
 	drm_info(dev, "File closing...");
-	drm_sched_entity_destroy(&priv->entity[SCHED_TSTQ_B]);
-	drm_sched_entity_destroy(&priv->entity[SCHED_TSTQ_A]);
+	for (i = SCHED_TEST_PRIORITY_MAX; i > 0;)
+		drm_sched_entity_destroy(&priv->balanced[--i]);
+	for (i = priv->sdev->num_queues * SCHED_TEST_PRIORITY_MAX; i > 0;)
+		drm_sched_entity_destroy(&priv->entity[--i]);
+	kfree(priv->entity);
+	mutex_destroy(&priv->submit_lock);
 	kfree(priv);
 	drm_info(dev, "File closed!");
 	file->driver_priv = NULL;
 }
 
-int sched_test_submit_ioctl(struct drm_device *dev, void *data,
-			    struct drm_file *file_priv)
+/*
+ * Adds every entry of the user's in_fences array as a dependency of the job. The
+ * entries are copied one at a time, so a long list needs no allocation.
+ */
+static int sched_test_add_in_fences(struct sched_test_job *job, struct drm_file *file_priv,
+				    const struct drm_sched_test_submit *args)
+{
+	struct drm_sched_test_syncobj __user *in_fences = u64_to_user_ptr(args->in_fences);
+	struct drm_sched_test_syncobj in;
+	u32 i;
+	int ret;
+
+	for (i = 0; i < args->in_fence_count; i++) {
+		if (copy_from_user(&in, &in_fences[i], sizeof(in)))
+			return -EFAULT;
+		if (!in.handle || in.pad)
+			return -EINVAL;
+		ret = sched_test_add_dependencies(job, file_priv, in.handle, in.point);
+		if (ret)
+			return ret;
+	}
+	return 0;
+}
+
+/*
+ * Submits one job. With SCHED_TEST_SUBMIT_OUT_SYNC_FILE the sync_file fd exported for
+ * the job's finished fence is returned in args->out_sync_file. pushed tells whether
+ * the job was submitted, which it may be also on failure.
+ */
+static int sched_test_submit_one(struct drm_device *dev, struct drm_sched_test_submit *args,
+				 struct drm_file *file_priv, bool *pushed)
 {
 	struct sched_test_file_priv *priv = file_priv->driver_priv;
-	const struct drm_sched_test_submit *args = data;
 	struct drm_syncobj *out_sync = NULL;
+	struct dma_fence_chain *out_chain = NULL;
+	struct sync_file *sync_file = NULL;
+	struct drm_sched_entity *entity;
+	struct dma_fence *done_fence;
 	struct sched_test_job *job;
+	int out_fd = -1;
 	int ret = 0;
 
+	*pushed = false;
+	if (args->flags & ~(SCHED_TEST_SUBMIT_BALANCED | SCHED_TEST_SUBMIT_OUT_SYNC_FILE))
+		return -EINVAL;
+	if (args->pad)
+		return -EINVAL;
+	if (args->in_fence_count > SCHED_TEST_MAX_IN_FENCES)
+		return -EINVAL;
+	if (args->priority >= SCHED_TEST_PRIORITY_MAX)
+		return -EINVAL;
+	if ((args->priority == SCHED_TEST_PRIORITY_KERNEL) && !capable(CAP_SYS_NICE))
+		return -EACCES;
+	if ((args->flags & SCHED_TEST_SUBMIT_BALANCED) && !priv->sdev->num_balance)
+		return -ENODEV;
+	if (args->flags & SCHED_TEST_SUBMIT_BALANCED)
+		entity = &priv->balanced[args->priority];
+	else if (args->qu < SCHED_TSTQ_A || args->qu >= priv->sdev->num_queues)
+		return -EINVAL;
+	else
+		entity = sched_test_entity(priv, args->qu, args->priority);
+
 	if (args->out_fence) {
 		out_sync = drm_syncobj_find(file_priv, args->out_fence);
 		if (!out_sync)
 			return -ENOENT;
+		/* Allocate the timeline chain node upfront, adding the point must not fail */
+		if (args->out_point) {
+			out_chain = dma_fence_chain_alloc();
+			if (!out_chain) {
+				ret = -ENOMEM;
+				goto out_put;
+			}
+		}
+	}
+
+	if (args->flags & SCHED_TEST_SUBMIT_OUT_SYNC_FILE) {
+		out_fd = get_unused_fd_flags(O_CLOEXEC);
+		if (out_fd < 0) {
+			ret = out_fd;
+			goto out_put;
+		}
 	}
 
-	drm_info(dev, "After out fence...");
-	job = kzalloc(sizeof(*job), GFP_KERNEL);
+	job = sched_test_job_alloc(priv->sdev);
 	if (!job) {
 		ret = -ENOMEM;
 		goto out_put;
 	}
 
-	job->qu = args->qu;
-
-	ret = sched_test_job_init(job, priv);
+	/* Jobs for a bypass queue never see its drm_sched entities, nor their priority */
+	if (!(args->flags & SCHED_TEST_SUBMIT_BALANCED) && priv->sdev->queue[args->qu].bypass)
+		ret = sched_test_bypass_job_init(job, args->qu);
+	else
+		ret = sched_test_job_init(job, entity);
 	if (ret)
 		goto out_free;
 
-	drm_info(dev, "After job init...");
 	if (args->in_fence) {
-		ret = sched_test_add_dependencies(job, file_priv, args->in_fence);
+		ret = sched_test_add_dependencies(job, file_priv, args->in_fence, args->in_point);
 		if (ret)
 			/*
 			 * Note if ret == -ENOENT, then it implies that user sent an empty sync
@@ -166,28 +263,258 @@ int sched_test_submit_ioctl(struct drm_device *dev, void *data,
 			goto out_dep;
 	}
 
-	drm_info(dev, "After in fence...");
-	if (out_sync) {
-		drm_syncobj_replace_fence(out_sync, job->done_fence);
+	if (args->in_fence_count) {
+		ret = sched_test_add_in_fences(job, file_priv, args);
+		if (ret)
+			goto out_dep;
+	}
+
+	/*
+	 * Nothing may fail from here on: an armed job must be pushed, its fences would
+	 * never signal otherwise. Arming and pushing is all submit_lock covers.
+	 */
+	mutex_lock(&priv->submit_lock);
+	sched_test_job_arm(job);
+	trace_sched_test_submit(job, args->priority, args->flags);
+	/* The job may complete and be freed as soon as it is pushed */
+	done_fence = dma_fence_get(job->done_fence);
+	sched_test_job_push(job);
+	mutex_unlock(&priv->submit_lock);
+	*pushed = true;
+
+	/* Should the sync_file not be created the job still runs, we only report the error */
+	if (out_fd >= 0) {
+		sync_file = sync_file_create(done_fence);
+		if (!sync_file)
+			ret = -ENOMEM;
+	}
+	if (out_chain) {
+		drm_syncobj_add_point(out_sync, out_chain, done_fence, args->out_point);
+		drm_syncobj_put(out_sync);
+	} else if (out_sync) {
+		drm_syncobj_replace_fence(out_sync, done_fence);
 		drm_syncobj_put(out_sync);
 	}
-	drm_sched_entity_push_job(&job->base);
-	drm_info(dev, "After push job...");
-	return 0;
+	dma_fence_put(done_fence);
+	if (sync_file) {
+		fd_install(out_fd, sync_file->file);
+		args->out_sync_file = out_fd;
+	} else if (out_fd >= 0) {
+		put_unused_fd(out_fd);
+	}
+	return ret;
 
 out_dep:
-	sched_test_job_fini(job);
+	sched_test_job_abort(job);
+	goto out_put;
 out_free:
-	kfree(job);
+	sched_test_job_destroy(job);
 out_put:
+	if (out_fd >= 0)
+		put_unused_fd(out_fd);
+	dma_fence_chain_free(out_chain);
 	if (out_sync)
 		drm_syncobj_put(out_sync);
 	return ret;
 }
 
+int sched_test_submit_ioctl(struct drm_device *dev, void *data,
+			    struct drm_file *file_priv)
+{
+	struct drm_sched_test_submit *args = data;
+	bool pushed;
+
+	return sched_test_submit_one(dev, args, file_priv, &pushed);
+}
+
+/*
+ * Push an array of jobs with one syscall. The descriptors are copied in one at a time
+ * and submitted in order; we stop at the first failure and report back how many made it.
+ */
+int sched_test_submit_batch_ioctl(struct drm_device *dev, void *data,
+				  struct drm_file *file_priv)
+{
+	struct drm_sched_test_submit_batch *args = data;
+	u8 __user *ptr = u64_to_user_ptr(args->submits);
+	struct drm_sched_test_submit submit;
+	bool pushed;
+	u32 i;
+	int ret = 0;
+
+	/* A descriptor too short to name its queue can only be a userspace bug */
+	if (args->stride < offsetofend(struct drm_sched_test_submit, qu))
+		return -EINVAL;
+
+	for (i = 0; i < args->count; i++, ptr += args->stride) {
+		/* count is up to the caller, don't hold the CPU or a dying task hostage */
+		if (fatal_signal_pending(current)) {
+			ret = -EINTR;
+			break;
+		}
+		cond_resched();
+		ret = copy_struct_from_user(&submit, sizeof(submit), ptr, args->stride);
+		if (ret)
+			break;
+		/* The exported fd is written back into the user's descriptor */
+		if ((submit.flags & SCHED_TEST_SUBMIT_OUT_SYNC_FILE) &&
+		    (args->stride < offsetofend(struct drm_sched_test_submit, out_sync_file))) {
+			ret = -EINVAL;
+			break;
+		}
+		ret = sched_test_submit_one(dev, &submit, file_priv, &pushed);
+		if (ret) {
+			/* The job is in flight, count it but let the caller know */
+			if (pushed)
+				i++;
+			break;
+		}
+		if ((submit.flags & SCHED_TEST_SUBMIT_OUT_SYNC_FILE) &&
+		    put_user(submit.out_sync_file,
+			     (__s32 __user *)(ptr + offsetof(struct drm_sched_test_submit, out_sync_file)))) {
+			/* The job is in flight, count it but let the caller know */
+			i++;
+			ret = -EFAULT;
+			break;
+		}
+	}
+
+	args->count = i;
+	return ret;
+}
+
+int sched_test_queue_config_ioctl(struct drm_device *dev, void *data,
+				  struct drm_file *file_priv)
+{
+	const struct drm_sched_test_queue_config *args = data;
+
+	if ((args->qu >= to_sched_test_dev(dev)->num_queues) || args->pad)
+		return -EINVAL;
+	if (args->flags & ~SCHED_TEST_QUEUE_CONFIG_AFFINITY)
+		return -EINVAL;
+	if (args->flags & SCHED_TEST_QUEUE_CONFIG_AFFINITY) {
+		if (!capable(CAP_SYS_NICE))
+			return -EACCES;
+		return sched_test_hwemu_set_affinity(to_sched_test_dev(dev), args->qu, args->hwemu_cpu,
+						     args->sched_cpu);
+	}
+
+	if (!capable(CAP_SYS_ADMIN))
+		return -EACCES;
+	return sched_test_hwemu_set_service(to_sched_test_dev(dev), args);
+}
+
+/*
+ * Generates jobs in the driver and pushes them through the same sched_test_job_init(),
+ * sched_test_job_arm() and sched_test_job_push() calls as the submit ioctl, timing
+ * every step, so the cost of drm_sched can be told apart from the cost of the uapi
+ * path. On a bypass queue the jobs go through the bypass FIFO instead, like submitted
+ * ones. The chain pattern holds a reference to the previous job's finished fence and
+ * hands it over to the next job as its dependency.
+ */
+int sched_test_microbench_ioctl(struct drm_device *dev, void *data,
+				struct drm_file *file_priv)
+{
+	struct sched_test_file_priv *priv = file_priv->driver_priv;
+	struct drm_sched_test_microbench *args = data;
+	struct drm_sched_entity *entity;
+	struct dma_fence *last = NULL;
+	struct sched_test_job *job;
+	u64 start, t0, t1;
+	u32 i;
+	int ret = 0;
+
+	if (!capable(CAP_SYS_ADMIN))
+		return -EACCES;
+	if ((args->qu >= priv->sdev->num_queues) || (args->pattern >= SCHED_TEST_MICROBENCH_MAX) ||
+	    (args->priority >= SCHED_TEST_PRIORITY_MAX) || !args->count ||
+	    (args->count > SCHED_TEST_MICROBENCH_MAX_JOBS) || args->pad)
+		return -EINVAL;
+	entity = sched_test_entity(priv, args->qu, args->priority);
+	args->alloc_ns = args->init_ns = args->deps_ns = args->push_ns = 0;
+	args->status = 0;
+
+	start = ktime_get_ns();
+	for (i = 0; i < args->count; i++) {
+		/*
+		 * The results are summed in args, an error would make userspace restart the
+		 * whole run, so report the partial results instead
+		 */
+		if (fatal_signal_pending(current)) {
+			args->status |= SCHED_TEST_MICROBENCH_INTERRUPTED;
+			break;
+		}
+		cond_resched();
+		t0 = ktime_get_ns();
+		job = sched_test_job_alloc(priv->sdev);
+		t1 = ktime_get_ns();
+		args->alloc_ns += t1 - t0;
+		if (!job) {
+			ret = -ENOMEM;
+			break;
+		}
+
+		if (priv->sdev->queue[args->qu].bypass)
+			ret = sched_test_bypass_job_init(job, args->qu);
+		else
+			ret = sched_test_job_init(job, entity);
+		t0 = ktime_get_ns();
+		args->init_ns += t0 - t1;
+		if (ret) {
+			sched_test_job_destroy(job);
+			break;
+		}
+
+		if (last && (args->pattern == SCHED_TEST_MICROBENCH_CHAIN)) {
+			/* Consumes our reference to the previous job's finished fence */
+			ret = sched_test_job_add_dependency(job, last);
+			last = NULL;
+			t1 = ktime_get_ns();
+			args->deps_ns += t1 - t0;
+			t0 = t1;
+			if (ret) {
+				sched_test_job_abort(job);
+				break;
+			}
+		}
+
+		dma_fence_put(last);
+		/* Arming is accounted to init_ns, like drm_sched_job_init() */
+		mutex_lock(&priv->submit_lock);
+		sched_test_job_arm(job);
+		t1 = ktime_get_ns();
+		args->init_ns += t1 - t0;
+		t0 = t1;
+
+		/* The job may complete and be freed as soon as it is pushed */
+		last = dma_fence_get(job->done_fence);
+		sched_test_job_push(job);
+		mutex_unlock(&priv->submit_lock);
+		args->push_ns += ktime_get_ns() - t0;
+	}
+
+	t0 = ktime_get_ns();
+	if (last) {
+		long err = dma_fence_wait(last, true);
+
+		dma_fence_put(last);
+		/* Like above, the ioctl must not be restarted */
+		if (err == -ERESTARTSYS)
+			args->status |= SCHED_TEST_MICROBENCH_INTERRUPTED;
+		else if (err && !ret)
+			ret = err;
+	}
+	t1 = ktime_get_ns();
+	args->wait_ns = t1 - t0;
+	args->total_ns = t1 - start;
+	args->count = i;
+	return ret;
+}
 
 static const struct drm_ioctl_desc sched_test_ioctls[] = {
 	DRM_IOCTL_DEF_DRV(SCHED_TEST_SUBMIT, sched_test_submit_ioctl, DRM_RENDER_ALLOW | DRM_AUTH),
+	DRM_IOCTL_DEF_DRV(SCHED_TEST_SUBMIT_BATCH, sched_test_submit_batch_ioctl, DRM_RENDER_ALLOW | DRM_AUTH),
+	DRM_IOCTL_DEF_DRV(SCHED_TEST_QUEUE_CONFIG, sched_test_queue_config_ioctl, DRM_RENDER_ALLOW | DRM_AUTH),
+	DRM_IOCTL_DEF_DRV(SCHED_TEST_MICROBENCH, sched_test_microbench_ioctl, DRM_RENDER_ALLOW | DRM_AUTH),
 };
 
 DEFINE_DRM_GEM_FOPS(sched_test_driver_fops);
@@ -199,6 +526,9 @@ static struct drm_driver sched_test_driver = {
 	.ioctls				= sched_test_ioctls,
 	.num_ioctls 			= ARRAY_SIZE(sched_test_ioctls),
 	.fops				= &sched_test_driver_fops,
+#if defined(CONFIG_DEBUG_FS)
+	.debugfs_init			= sched_test_debugfs_init,
+#endif
 	.name	= DRIVER_NAME,
 	.desc	= DRIVER_DESC,
 	.date	= DRIVER_DATE,
@@ -226,6 +556,20 @@ static int __init sched_test_init(void)
 	}
 	sched_test_device_obj->platform = pdev;
 
+	if (!num_queues || (num_queues > SCHED_TEST_MAX_QUEUES)) {
+		ret = -EINVAL;
+		goto out_devres;
+	}
+	sched_test_device_obj->num_queues = num_queues;
+	sched_test_device_obj->queue = devm_kcalloc(&pdev->dev, num_queues,
+						    sizeof(*sched_test_device_obj->queue), GFP_KERNEL);
+	sched_test_device_obj->hwemu = devm_kcalloc(&pdev->dev, num_queues,
+						    sizeof(*sched_test_device_obj->hwemu), GFP_KERNEL);
+	if (!sched_test_device_obj->queue || !sched_test_device_obj->hwemu) {
+		ret = -ENOMEM;
+		goto out_devres;
+	}
+
 	ret = sched_test_sched_init(sched_test_device_obj);
 	if (ret < 0)
 		goto out_devres;
@@ -255,6 +599,8 @@ static void __exit sched_test_exit(void)
 {
 	struct platform_device *pdev = sched_test_device_obj->platform;
 
+	/* Jobs abandoned on a bypass queue still need the emulated HW to complete */
+	sched_test_bypass_drain(sched_test_device_obj);
 	sched_test_hwemu_threads_stop(sched_test_device_obj);
 	drm_dev_unregister(&sched_test_device_obj->drm);
 	sched_test_sched_fini(sched_test_device_obj);
@@ -0,0 +1,127 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Copyright (C) 2022-2023 Advanced Micro Devices, Inc.
+ * Authors:
+ *     Sonal Santan <sonal.santan@amd.com>
+ */
+
+#if !defined(_SCHED_TEST_TRACE_H_) || defined(TRACE_HEADER_MULTI_READ)
+#define _SCHED_TEST_TRACE_H_
+
+#include <linux/stringify.h>
+#include <linux/types.h>
+#include <linux/tracepoint.h>
+
+#include "sched_test_common.h"
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM sched_test
+#define TRACE_INCLUDE_FILE sched_test_trace
+
+/*
+ * Job lifecycle events. A job is identified by the fence context and seqno of its
+ * done fence, the scheduler finished fence assigned when the job is armed or, on a
+ * bypass queue, the irq fence; qu is the queue the job runs on.
+ */
+DECLARE_EVENT_CLASS(sched_test_job,
+	    TP_PROTO(struct sched_test_job *job),
+	    TP_ARGS(job),
+	    TP_STRUCT__entry(
+			     __field(u32, qu)
+			     __field(u64, ctx)
+			     __field(u64, seqno)
+			     ),
+	    TP_fast_assign(
+			   __entry->qu = job->qu;
+			   __entry->ctx = job->done_fence->context;
+			   __entry->seqno = job->done_fence->seqno;
+			   ),
+	    TP_printk("qu=%u ctx=%llu seqno=%llu", __entry->qu, __entry->ctx, __entry->seqno)
+);
+
+/*
+ * The submit ioctl has added the dependencies of the job and armed it. job ties the job
+ * to its sched_test_add_dep events.
+ */
+TRACE_EVENT(sched_test_submit,
+	    TP_PROTO(struct sched_test_job *job, u32 priority, u32 flags),
+	    TP_ARGS(job, priority, flags),
+	    TP_STRUCT__entry(
+			     __field(const void *, job)
+			     __field(u32, qu)
+			     __field(u64, ctx)
+			     __field(u64, seqno)
+			     __field(u32, priority)
+			     __field(u32, flags)
+			     ),
+	    TP_fast_assign(
+			   __entry->qu = job->qu;
+			   __entry->ctx = job->done_fence->context;
+			   __entry->seqno = job->done_fence->seqno;
+			   __entry->priority = priority;
+			   __entry->flags = flags;
+			   __entry->job = job;
+			   ),
+	    TP_printk("job=0x%p qu=%u ctx=%llu seqno=%llu priority=%u flags=0x%x", __entry->job,
+		      __entry->qu, __entry->ctx, __entry->seqno, __entry->priority, __entry->flags)
+);
+
+/*
+ * A syncobj point was added as a dependency of the job. The job is not armed yet and has
+ * no fence, it is identified by its address until its sched_test_submit event.
+ */
+TRACE_EVENT(sched_test_add_dep,
+	    TP_PROTO(struct sched_test_job *job, u32 handle, u64 point, int ret),
+	    TP_ARGS(job, handle, point, ret),
+	    TP_STRUCT__entry(
+			     __field(const void *, job)
+			     __field(u32, handle)
+			     __field(u64, point)
+			     __field(int, ret)
+			     ),
+	    TP_fast_assign(
+			   __entry->job = job;
+			   __entry->handle = handle;
+			   __entry->point = point;
+			   __entry->ret = ret;
+			   ),
+	    TP_printk("job=0x%p handle=%u point=%llu ret=%d", __entry->job, __entry->handle,
+		      __entry->point, __entry->ret)
+);
+
+/* The job is about to be pushed to its entity */
+DEFINE_EVENT(sched_test_job, sched_test_push,
+	    TP_PROTO(struct sched_test_job *job),
+	    TP_ARGS(job)
+);
+
+/* run_job hands the job to the emulated HW */
+DEFINE_EVENT(sched_test_job, sched_test_run,
+	    TP_PROTO(struct sched_test_job *job),
+	    TP_ARGS(job)
+);
+
+/* The emulated HW picked the job up from its ring */
+DEFINE_EVENT(sched_test_job, sched_test_hw_dequeue,
+	    TP_PROTO(struct sched_test_job *job),
+	    TP_ARGS(job)
+);
+
+/* The emulated HW signals the job's irq fence */
+DEFINE_EVENT(sched_test_job, sched_test_signal,
+	    TP_PROTO(struct sched_test_job *job),
+	    TP_ARGS(job)
+);
+
+/* free_job */
+DEFINE_EVENT(sched_test_job, sched_test_free,
+	    TP_PROTO(struct sched_test_job *job),
+	    TP_ARGS(job)
+);
+
+#endif /* _SCHED_TEST_TRACE_H_ */
+
+/* This part must be outside protection */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#include <trace/define_trace.h>
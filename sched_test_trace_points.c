@@ -0,0 +1,9 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Copyright (C) 2022-2023 Advanced Micro Devices, Inc.
+ * Authors:
+ *     Sonal Santan <sonal.santan@amd.com>
+ */
+
+#define CREATE_TRACE_POINTS
+#include "sched_test_trace.h"
@@ -0,0 +1,978 @@
+/* SPDX-License-Identifier: LGPL-2.1 OR MIT */
+/*
+ * Copyright (C) 2023 Advanced Micro Devices, Inc.
+ * Authors:
+ *     Sonal Santan <sonal.santan@amd.com>
+ */
+
+#include <drm/drm.h>
+#include <unistd.h>
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <system_error>
+#include <stdexcept>
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+#include <memory>
+#include <vector>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <random>
+
+#include "sched_test.h"
+#include "common.h"
+
+/*
+ * Benchmark driver running one of several workloads from a number of in-process worker
+ * threads, each with its own device fd or all sharing one. The workers are released
+ * together from a common start gate and their results are aggregated and written out as
+ * JSON.
+ *
+ * Workloads:
+ *   pipelined  submit all the jobs, spread round robin over the queues, then reap them
+ *   sync       submit a job, or a batch of jobs, and wait for it before the next one
+ *   chain      one chain of jobs, round robin over the queues, each waiting on the previous
+ *   dag        rounds of a root job fanning out to several jobs over the queues and one
+ *              join job waiting for all of them, each round waiting on the previous one
+ *   open       open loop, jobs arrive round robin over the queues at an offered rate with
+ *              fixed or exponentially distributed interarrival times, and completions are
+ *              reaped while waiting for the next arrival
+ *   random     instances of a seeded random layered DAG with jobs on random queues, each
+ *              instance waited for before the next one, against its critical path alone
+ *   kernel     the driver generates the jobs itself with DRM_IOCTL_SCHED_TEST_MICROBENCH,
+ *              leaving out the uapi path, each worker on its own queue (CAP_SYS_ADMIN)
+ */
+
+typedef std::chrono::high_resolution_clock benchClock;
+
+struct options {
+	unsigned minor = 128;
+	std::string workload = "pipelined";
+	unsigned threads = 1;
+	bool sharedFd = false;
+	// Jobs per thread, or DAG rounds per thread
+	int count = 10000;
+	int batch = 1;
+	unsigned first = SCHED_TSTQ_A;
+	unsigned queues = 1;
+	bool timeline = true;
+	bool pooled = true;
+	bool abandon = false;
+	unsigned fan = 4;
+	bool chainJoin = false;
+	bool handoff = false;
+	// Offered rates of the open workload in jobs/s over all workers, one run per rate
+	std::vector<double> rates;
+	double rate = 0;
+	bool poisson = true;
+	unsigned seed = 1;
+	// Shape of the random DAG
+	unsigned width = 8;
+	unsigned depth = 8;
+	unsigned fanIn = 2;
+	unsigned fanOut = 2;
+	double crossRatio = 0.5;
+	std::string service;
+	bool irq = false;
+	std::string output;
+};
+
+struct result {
+	uint64_t jobs = 0;
+	benchClock::time_point start;
+	benchClock::time_point end;
+	// Submit to completion latency of the jobs, per queue used
+	std::vector<schedtest::latencyHistogram> latency;
+	// Time to run a random DAG instance and its critical path alone
+	schedtest::latencyHistogram makespan;
+	schedtest::latencyHistogram criticalPath;
+	// Timing breakdown returned by the kernel workload
+	drm_sched_test_microbench microbench = {};
+};
+
+struct dagNode {
+	unsigned slot;
+	std::vector<unsigned> parents;
+	unsigned children;
+};
+
+/*
+ * Layered DAG of width * depth nodes, stored level by level so the parents of a node
+ * always come before it
+ */
+struct randomDag {
+	std::vector<dagNode> nodes;
+	unsigned edges = 0;
+	unsigned crossEdges = 0;
+	// Longest path in jobs, from a root to a sink
+	std::vector<unsigned> criticalPath;
+};
+
+// Holds the workers until all of them are set up and then releases them together
+class startGate {
+	std::mutex _mutex;
+	std::condition_variable _cv;
+	const unsigned _count;
+	unsigned _waiting = 0;
+public:
+	startGate(unsigned count) : _count(count) {
+	}
+	benchClock::time_point wait() {
+		std::unique_lock<std::mutex> lock(_mutex);
+		if (++_waiting == _count)
+			_cv.notify_all();
+		else
+			_cv.wait(lock, [this] { return _waiting >= _count; });
+		return benchClock::now();
+	}
+};
+
+static sched_test_queue queueOf(const options &opts, unsigned i)
+{
+	return static_cast<sched_test_queue>(opts.first + (i % opts.queues));
+}
+
+/*
+ * Every node below the first level gets 1 to fanIn parents from the level above, picked
+ * among the nodes with fewer than fanOut children. An edge crosses queues with probability
+ * crossRatio, falling back to the other kind when no parent of the wanted kind is left.
+ */
+static randomDag buildDag(const options &opts)
+{
+	std::mt19937_64 rng(opts.seed);
+	std::uniform_int_distribution<unsigned> queue(0, opts.queues - 1);
+	std::uniform_int_distribution<unsigned> fanIn(1, opts.fanIn);
+	std::bernoulli_distribution cross(opts.crossRatio);
+	randomDag dag;
+	std::vector<unsigned> candidates;
+
+	dag.nodes.reserve(opts.width * opts.depth);
+	for (unsigned level = 0; level < opts.depth; level++) {
+		for (unsigned w = 0; w < opts.width; w++) {
+			dagNode node = {queue(rng), {}, 0};
+			const unsigned parents = level ? fanIn(rng) : 0;
+			for (unsigned e = 0; e < parents; e++) {
+				const bool wantCross = (opts.queues > 1) && cross(rng);
+				for (int relaxed = 0; relaxed < 2; relaxed++) {
+					candidates.clear();
+					for (unsigned p = (level - 1) * opts.width; p < level * opts.width; p++) {
+						const bool isCross = (dag.nodes[p].slot != node.slot);
+						if ((dag.nodes[p].children < opts.fanOut) &&
+						    (std::find(node.parents.begin(), node.parents.end(), p) == node.parents.end()) &&
+						    (relaxed || (isCross == wantCross)))
+							candidates.push_back(p);
+					}
+					if (!candidates.empty())
+						break;
+				}
+				if (candidates.empty())
+					break;
+				const unsigned p = candidates[std::uniform_int_distribution<size_t>(0, candidates.size() - 1)(rng)];
+				node.parents.push_back(p);
+				dag.nodes[p].children++;
+				dag.edges++;
+				dag.crossEdges += (dag.nodes[p].slot != node.slot);
+			}
+			dag.nodes.push_back(node);
+		}
+	}
+
+	std::vector<unsigned> length(dag.nodes.size(), 1);
+	std::vector<int> prev(dag.nodes.size(), -1);
+	unsigned last = 0;
+	for (unsigned n = 0; n < dag.nodes.size(); n++) {
+		for (unsigned p : dag.nodes[n].parents) {
+			if (length[p] + 1 > length[n]) {
+				length[n] = length[p] + 1;
+				prev[n] = p;
+			}
+		}
+		if (length[n] > length[last])
+			last = n;
+	}
+	for (int n = last; n >= 0; n = prev[n])
+		dag.criticalPath.insert(dag.criticalPath.begin(), n);
+	return dag;
+}
+
+static uint64_t nsBetween(benchClock::time_point from, benchClock::time_point to)
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(to - from).count();
+}
+
+/*
+ * Observes the completion of jobs which signal successive points of timeline syncobjs.
+ * The submit time of every point is stamped into a buffer sized upfront; poll() reads the
+ * last signaled point of all the timelines with one query ioctl and records the latency of
+ * every point completed since into the histogram of the queue the timeline belongs to. The
+ * completion time is the time of the poll, so the workloads poll often while submitting
+ * and drain() waits for the next outstanding point before every poll.
+ */
+class completionTracker {
+	struct timeline {
+		unsigned slot;
+		uint64_t completed;
+		std::vector<benchClock::time_point> submitted;
+	};
+	const schedtest::raii &_f;
+	std::vector<schedtest::latencyHistogram> &_latency;
+	std::vector<timeline> _timelines;
+	std::vector<const schedtest::syncobj *> _syncobjs;
+	std::vector<uint32_t> _handles;
+	std::vector<uint64_t> _points;
+	schedtest::waitset _pending;
+
+	void record(benchClock::time_point now) {
+		for (size_t t = 0; t < _timelines.size(); t++) {
+			timeline &tl = _timelines[t];
+			for (; tl.completed < std::min<uint64_t>(_points[t], tl.submitted.size()); tl.completed++)
+				_latency[tl.slot].record(nsBetween(tl.submitted[tl.completed], now));
+		}
+	}
+public:
+	completionTracker(const schedtest::raii &f, std::vector<schedtest::latencyHistogram> &latency,
+			  size_t timelines) : _f(f), _latency(latency), _pending(f.createWaitset(timelines)) {
+		_timelines.reserve(timelines);
+		_syncobjs.reserve(timelines);
+		_handles.reserve(timelines);
+		_points.reserve(timelines);
+	}
+	// Tracks the points 1 to points of sobj, signaled by jobs on the queue of slot
+	void add(const schedtest::syncobj &sobj, unsigned slot, size_t points) {
+		_timelines.push_back({slot, 0, {}});
+		_timelines.back().submitted.reserve(points);
+		_syncobjs.push_back(&sobj);
+		_handles.push_back(sobj());
+		_points.push_back(0);
+	}
+	// The next point of timeline t was submitted at ts
+	void submitted(unsigned t, benchClock::time_point ts) {
+		_timelines[t].submitted.push_back(ts);
+	}
+	void poll() {
+		_f.queryTimelines(_handles, _points);
+		record(benchClock::now());
+	}
+	/*
+	 * Waits for the next outstanding point of any timeline to signal, or for the absolute
+	 * CLOCK_MONOTONIC deadline to pass, then polls; returns false if nothing is outstanding
+	 */
+	bool waitUntil(int64_t deadline) {
+		_pending.clear();
+		for (size_t t = 0; t < _timelines.size(); t++) {
+			if (_timelines[t].completed < _timelines[t].submitted.size())
+				_pending.add(*_syncobjs[t], _timelines[t].completed + 1);
+		}
+		if (!_pending.size())
+			return false;
+		_pending.waitAny(deadline);
+		poll();
+		return true;
+	}
+	void drain() {
+		poll();
+		while (waitUntil(INT64_MAX))
+			;
+	}
+};
+
+// Submit ioctls between two polls of the completion tracker
+static const int pollInterval = 16;
+
+static void runPipelined(const schedtest::raii &f, const options &opts, startGate &gate, result &res)
+{
+	/*
+	 * In timeline mode every queue signals successive points of one timeline syncobj and
+	 * the latency of every job is tracked, otherwise every job signals its own binary
+	 * syncobj, from a pool unless disabled, and only the throughput is measured
+	 */
+	schedtest::syncobjPool pool(f.createPool((!opts.timeline && opts.pooled) ? opts.count : 0));
+	std::vector<schedtest::syncobj> timelines;
+	std::vector<uint64_t> points(opts.queues, 0);
+	std::vector<schedtest::syncobj> soutobjs;
+	std::vector<drm_sched_test_submit> batchCmds;
+	std::vector<unsigned> batchSlots;
+	schedtest::waitset reap(f.createWaitset(std::min<size_t>(opts.count, schedtest::reapChunk)));
+	completionTracker tracker(f, res.latency, opts.queues);
+	for (unsigned qu = 0; opts.timeline && (qu < opts.queues); qu++)
+		timelines.push_back(f.createSyncobj());
+	for (unsigned qu = 0; qu < timelines.size(); qu++)
+		tracker.add(timelines[qu], qu, opts.count / opts.queues + 1);
+	soutobjs.reserve(opts.timeline ? 0 : opts.count);
+	batchCmds.reserve(opts.batch);
+	batchSlots.reserve(opts.batch);
+
+	res.start = gate.wait();
+	for (int i = 0, ioctls = 0; i < opts.count; i++) {
+		const unsigned slot = i % opts.queues;
+		drm_sched_test_submit submit = {0, 0, queueOf(opts, i)};
+		if (opts.timeline) {
+			submit.out_fence = timelines[slot]();
+			submit.out_point = ++points[slot];
+		} else {
+			soutobjs.push_back(opts.pooled ? pool.get() : f.createSyncobj());
+			submit.out_fence = soutobjs.back()();
+		}
+		batchCmds.push_back(submit);
+		batchSlots.push_back(slot);
+		if ((batchCmds.size() < (size_t)opts.batch) && (i < opts.count - 1))
+			continue;
+		for (unsigned s : batchSlots) {
+			if (opts.timeline)
+				tracker.submitted(s, benchClock::now());
+		}
+		if (opts.batch == 1)
+			f.callIoctl(DRM_IOCTL_SCHED_TEST_SUBMIT, &batchCmds.front());
+		else
+			f.submitBatch(batchCmds);
+		batchCmds.clear();
+		batchSlots.clear();
+		if (opts.timeline && !(++ioctls % pollInterval))
+			tracker.poll();
+	}
+
+	// Up to reapChunk jobs per wait ioctl, nothing at all when abandoning them to the driver
+	if (opts.timeline && !opts.abandon)
+		tracker.drain();
+	for (size_t i = 0; !opts.abandon && (i < soutobjs.size()); i++) {
+		reap.add(soutobjs[i]);
+		if (reap.size() == schedtest::reapChunk) {
+			reap.waitAll();
+			reap.clear();
+		}
+	}
+	if (!opts.abandon)
+		reap.waitAll();
+	res.end = benchClock::now();
+	res.jobs = opts.count;
+}
+
+static void runSync(const schedtest::raii &f, const options &opts, startGate &gate, result &res)
+{
+	/*
+	 * Every round trip submits batch jobs and waits for all of them with one wait ioctl,
+	 * the latency of every job of the round is the round trip
+	 */
+	schedtest::syncobjPool pool(f.createPool((!opts.timeline && opts.pooled) ? std::max(opts.batch, 64) : 0));
+	const schedtest::syncobj timeline(opts.timeline ? f.createSyncobj() : schedtest::syncobj());
+	std::vector<schedtest::syncobj> soutobjs;
+	std::vector<drm_sched_test_submit> batchCmds;
+	schedtest::waitset reap(f.createWaitset(opts.batch));
+	uint64_t point = 0;
+	soutobjs.reserve(opts.batch);
+	batchCmds.reserve(opts.batch);
+
+	res.start = gate.wait();
+	for (int i = 0; i < opts.count; i += opts.batch) {
+		for (int j = i; (j < opts.count) && (j < i + opts.batch); j++) {
+			drm_sched_test_submit submit = {0, 0, queueOf(opts, j)};
+			if (opts.timeline) {
+				submit.out_fence = timeline();
+				submit.out_point = ++point;
+			} else {
+				soutobjs.push_back(opts.pooled ? pool.get() : f.createSyncobj());
+				submit.out_fence = soutobjs.back()();
+				reap.add(soutobjs.back());
+			}
+			batchCmds.push_back(submit);
+		}
+		const auto submitted = benchClock::now();
+		if (batchCmds.size() == 1)
+			f.callIoctl(DRM_IOCTL_SCHED_TEST_SUBMIT, &batchCmds.front());
+		else
+			f.submitBatch(batchCmds);
+		// A timeline point only signals once all the points before it have signaled
+		if (opts.timeline)
+			timeline.wait(point);
+		else
+			reap.waitAll();
+		const uint64_t ns = nsBetween(submitted, benchClock::now());
+		for (size_t j = 0; j < batchCmds.size(); j++)
+			res.latency[(i + j) % opts.queues].record(ns);
+		reap.clear();
+		soutobjs.clear();
+		batchCmds.clear();
+	}
+	res.end = benchClock::now();
+	res.jobs = opts.count;
+}
+
+static void runChain(const schedtest::raii &f, const options &opts, startGate &gate, result &res)
+{
+	// Every queue signals successive points of its own timeline syncobj
+	std::vector<schedtest::syncobj> timelines;
+	std::vector<uint64_t> points(opts.queues, 0);
+	completionTracker tracker(f, res.latency, opts.queues);
+	for (unsigned qu = 0; qu < opts.queues; qu++)
+		timelines.push_back(f.createSyncobj());
+	for (unsigned qu = 0; qu < opts.queues; qu++)
+		tracker.add(timelines[qu], qu, opts.count / opts.queues + 1);
+	unsigned prev = 0;
+
+	res.start = gate.wait();
+	for (int i = 0; i < opts.count; i++) {
+		const unsigned slot = i % opts.queues;
+		drm_sched_test_submit submit = {points[prev] ? timelines[prev]() : 0, timelines[slot](),
+			queueOf(opts, i)};
+		submit.in_point = points[prev];
+		submit.out_point = ++points[slot];
+		tracker.submitted(slot, benchClock::now());
+		f.callIoctl(DRM_IOCTL_SCHED_TEST_SUBMIT, &submit);
+		if (!((i + 1) % pollInterval))
+			tracker.poll();
+		prev = slot;
+	}
+	if (!opts.abandon)
+		tracker.drain();
+	res.end = benchClock::now();
+	res.jobs = opts.count;
+}
+
+static void runDag(const schedtest::raii &f, const options &opts, startGate &gate, result &res)
+{
+	/*
+	 * Every node of the DAG signals successive points of its own timeline syncobj. With
+	 * chainJoin the join is built from fan single in-fence jobs on the first queue, where
+	 * entity FIFO order makes the last one complete after all of them, otherwise one join
+	 * job waits on all fan in-fences. The latency of the jobs signaling a syncobj is
+	 * tracked, which leaves out the intermediate jobs of a chained join.
+	 */
+	const schedtest::syncobj root(f.createSyncobj());
+	const schedtest::syncobj join(f.createSyncobj());
+	std::vector<schedtest::syncobj> fan;
+	std::vector<drm_sched_test_syncobj> joinFences(opts.fan);
+	completionTracker tracker(f, res.latency, opts.fan + 2);
+	for (unsigned k = 0; k < opts.fan; k++) {
+		fan.push_back(f.createSyncobj());
+		joinFences[k].handle = fan.back()();
+	}
+	const sched_test_queue home = queueOf(opts, 0);
+	tracker.add(root, 0, opts.count);
+	tracker.add(join, 0, opts.count);
+	for (unsigned k = 0; k < opts.fan; k++)
+		tracker.add(fan[k], k % opts.queues, opts.count);
+
+	res.start = gate.wait();
+	for (uint64_t round = 1; round <= (uint64_t)opts.count; round++) {
+		drm_sched_test_submit submit = {(round > 1) ? join() : 0, root(), home};
+		submit.in_point = round - 1;
+		submit.out_point = round;
+		tracker.submitted(0, benchClock::now());
+		f.callIoctl(DRM_IOCTL_SCHED_TEST_SUBMIT, &submit);
+		res.jobs++;
+
+		for (unsigned k = 0; k < opts.fan; k++) {
+			drm_sched_test_submit fsubmit = {root(), fan[k](), queueOf(opts, k)};
+			fsubmit.in_point = round;
+			fsubmit.out_point = round;
+			tracker.submitted(2 + k, benchClock::now());
+			f.callIoctl(DRM_IOCTL_SCHED_TEST_SUBMIT, &fsubmit);
+			joinFences[k].point = round;
+			res.jobs++;
+		}
+
+		if (opts.chainJoin) {
+			for (unsigned k = 0; k < opts.fan; k++) {
+				const bool last = (k == opts.fan - 1);
+				drm_sched_test_submit jsubmit = {fan[k](), last ? join() : 0, home};
+				jsubmit.in_point = round;
+				jsubmit.out_point = last ? round : 0;
+				if (last)
+					tracker.submitted(1, benchClock::now());
+				f.callIoctl(DRM_IOCTL_SCHED_TEST_SUBMIT, &jsubmit);
+				res.jobs++;
+			}
+		} else {
+			drm_sched_test_submit jsubmit = {0, join(), home};
+			jsubmit.out_point = round;
+			jsubmit.in_fence_count = opts.fan;
+			jsubmit.in_fences = reinterpret_cast<uintptr_t>(joinFences.data());
+			tracker.submitted(1, benchClock::now());
+			f.callIoctl(DRM_IOCTL_SCHED_TEST_SUBMIT, &jsubmit);
+			res.jobs++;
+		}
+		tracker.poll();
+	}
+	if (!opts.abandon)
+		tracker.drain();
+	res.end = benchClock::now();
+}
+
+static void runOpen(const schedtest::raii &f, const options &opts, unsigned worker, startGate &gate, result &res)
+{
+	/*
+	 * Every queue signals successive points of one timeline syncobj. The latency of a job
+	 * is measured from its scheduled arrival rather than from its submit ioctl, so a
+	 * submitter falling behind the offered rate shows up as latency instead of silently
+	 * lowering the load.
+	 */
+	std::vector<schedtest::syncobj> timelines;
+	std::vector<uint64_t> points(opts.queues, 0);
+	completionTracker tracker(f, res.latency, opts.queues);
+	for (unsigned qu = 0; qu < opts.queues; qu++)
+		timelines.push_back(f.createSyncobj());
+	for (unsigned qu = 0; qu < opts.queues; qu++)
+		tracker.add(timelines[qu], qu, opts.count / opts.queues + 1);
+	const double intervalNs = 1000000000.0 * opts.threads / opts.rate;
+	std::mt19937_64 rng(opts.seed + worker);
+	std::exponential_distribution<double> interval(1.0 / intervalNs);
+	double offsetNs = 0;
+
+	res.start = gate.wait();
+	for (int i = 0; i < opts.count; i++) {
+		offsetNs += opts.poisson ? interval(rng) : intervalNs;
+		const benchClock::time_point arrival = res.start +
+			std::chrono::duration_cast<benchClock::duration>(std::chrono::nanoseconds((uint64_t)offsetNs));
+		// Reap completions until the job arrives, sleep if there is nothing to reap
+		for (auto now = benchClock::now(); now < arrival; now = benchClock::now()) {
+			if (!tracker.waitUntil(schedtest::deadlineIn(nsBetween(now, arrival))))
+				std::this_thread::sleep_until(arrival);
+		}
+		const unsigned slot = i % opts.queues;
+		drm_sched_test_submit submit = {0, timelines[slot](), queueOf(opts, i)};
+		submit.out_point = ++points[slot];
+		tracker.submitted(slot, arrival);
+		f.callIoctl(DRM_IOCTL_SCHED_TEST_SUBMIT, &submit);
+		// Keep reaping when behind the offered rate and never waiting for an arrival
+		if (!((i + 1) % pollInterval))
+			tracker.poll();
+	}
+	if (!opts.abandon)
+		tracker.drain();
+	res.end = benchClock::now();
+	res.jobs = opts.count;
+}
+
+static void runRandom(const schedtest::raii &f, const options &opts, startGate &gate, result &res)
+{
+	/*
+	 * Every node signals successive points of its own timeline syncobj, one point per
+	 * instance, and waits on the same point of its parents' syncobjs. The critical path is
+	 * first run alone, as a chain of its jobs on their queues signaling one timeline, as the
+	 * reference for the makespan of the whole DAG.
+	 */
+	const randomDag dag = buildDag(opts);
+	const schedtest::syncobj chain(f.createSyncobj());
+	std::vector<schedtest::syncobj> timelines;
+	std::vector<std::vector<drm_sched_test_syncobj>> inFences(dag.nodes.size());
+	schedtest::waitset sinks(f.createWaitset(dag.nodes.size()));
+	for (size_t n = 0; n < dag.nodes.size(); n++)
+		timelines.push_back(f.createSyncobj());
+	for (size_t n = 0; n < dag.nodes.size(); n++) {
+		for (unsigned p : dag.nodes[n].parents)
+			inFences[n].push_back({static_cast<__u32>(timelines[p]()), 0, 0});
+	}
+
+	uint64_t point = 0;
+	for (int i = 0; i < opts.count; i++) {
+		const auto start = benchClock::now();
+		for (size_t j = 0; j < dag.criticalPath.size(); j++) {
+			drm_sched_test_submit submit = {j ? chain() : 0, chain(),
+				queueOf(opts, dag.nodes[dag.criticalPath[j]].slot)};
+			submit.in_point = j ? point : 0;
+			submit.out_point = ++point;
+			f.callIoctl(DRM_IOCTL_SCHED_TEST_SUBMIT, &submit);
+		}
+		chain.wait(point);
+		res.criticalPath.record(nsBetween(start, benchClock::now()));
+	}
+
+	res.start = gate.wait();
+	for (uint64_t instance = 1; instance <= (uint64_t)opts.count; instance++) {
+		const auto start = benchClock::now();
+		sinks.clear();
+		for (size_t n = 0; n < dag.nodes.size(); n++) {
+			const dagNode &node = dag.nodes[n];
+			drm_sched_test_submit submit = {0, timelines[n](), queueOf(opts, node.slot)};
+			submit.out_point = instance;
+			if (node.parents.size() == 1) {
+				submit.in_fence = timelines[node.parents.front()]();
+				submit.in_point = instance;
+			} else if (node.parents.size() > 1) {
+				for (drm_sched_test_syncobj &in : inFences[n])
+					in.point = instance;
+				submit.in_fence_count = inFences[n].size();
+				submit.in_fences = reinterpret_cast<uintptr_t>(inFences[n].data());
+			}
+			f.callIoctl(DRM_IOCTL_SCHED_TEST_SUBMIT, &submit);
+			if (!node.children)
+				sinks.add(timelines[n], instance);
+		}
+		sinks.waitAll();
+		res.makespan.record(nsBetween(start, benchClock::now()));
+	}
+	res.end = benchClock::now();
+	res.jobs = (uint64_t)opts.count * dag.nodes.size();
+}
+
+static void runKernel(const schedtest::raii &f, const options &opts, unsigned worker, startGate &gate, result &res)
+{
+	drm_sched_test_microbench args = {queueOf(opts, worker), static_cast<__u32>(opts.count),
+		opts.chainJoin ? SCHED_TEST_MICROBENCH_CHAIN : SCHED_TEST_MICROBENCH_INDEPENDENT};
+
+	res.start = gate.wait();
+	f.callIoctl(DRM_IOCTL_SCHED_TEST_MICROBENCH, &args);
+	res.end = benchClock::now();
+	if (args.status & SCHED_TEST_MICROBENCH_INTERRUPTED)
+		throw std::runtime_error("kernel microbench interrupted after " + std::to_string(args.count) + " jobs");
+	res.jobs = args.count;
+	res.microbench = args;
+}
+
+static void runWorker(const schedtest::raii *shared, const options &opts, unsigned worker, startGate &gate,
+		      result &res)
+{
+	std::unique_ptr<schedtest::raii> own;
+	if (!shared) {
+		own.reset(new schedtest::raii(opts.minor));
+		shared = own.get();
+	}
+	if (opts.workload == "pipelined")
+		runPipelined(*shared, opts, gate, res);
+	else if (opts.workload == "sync")
+		runSync(*shared, opts, gate, res);
+	else if (opts.workload == "chain")
+		runChain(*shared, opts, gate, res);
+	else if (opts.workload == "dag")
+		runDag(*shared, opts, gate, res);
+	else if (opts.workload == "random")
+		runRandom(*shared, opts, gate, res);
+	else if (opts.workload == "kernel")
+		runKernel(*shared, opts, worker, gate, res);
+	else
+		runOpen(*shared, opts, worker, gate, res);
+}
+
+static void writeLatency(std::ostream &json, const schedtest::latencyHistogram &hist)
+{
+	json << "{\"count\": " << hist.count() << ", \"mean\": " << hist.mean() / 1000.0
+	     << ", \"p50\": " << hist.percentile(50) / 1000.0 << ", \"p90\": " << hist.percentile(90) / 1000.0
+	     << ", \"p99\": " << hist.percentile(99) / 1000.0 << ", \"p99.9\": " << hist.percentile(99.9) / 1000.0
+	     << ", \"max\": " << hist.max() / 1000.0 << "}";
+}
+
+// Runs the workload on all the workers and writes the aggregated results as a JSON object
+static double runAll(const options &opts, std::ostream &json)
+{
+	std::unique_ptr<schedtest::raii> shared;
+	if (opts.sharedFd)
+		shared.reset(new schedtest::raii(opts.minor));
+	startGate gate(opts.threads);
+	std::vector<result> results(opts.threads);
+	for (result &res : results)
+		res.latency.resize(opts.queues);
+	std::vector<std::exception_ptr> errors(opts.threads);
+	std::vector<std::thread> workers;
+
+	const double hwemuStart = schedtest::hwemuCpuTime();
+	for (unsigned t = 0; t < opts.threads; t++) {
+		workers.emplace_back([&, t]() {
+			try {
+				runWorker(shared.get(), opts, t, gate, results[t]);
+			} catch (...) {
+				errors[t] = std::current_exception();
+				// Do not leave the other workers waiting at the gate
+				results[t].start = gate.wait();
+				results[t].end = results[t].start;
+			}
+		});
+	}
+	for (std::thread &worker : workers)
+		worker.join();
+	const double hwemuEnd = schedtest::hwemuCpuTime();
+	for (std::exception_ptr &error : errors) {
+		if (error)
+			std::rethrow_exception(error);
+	}
+
+	benchClock::time_point start = results.front().start;
+	benchClock::time_point end = results.front().end;
+	uint64_t jobs = 0;
+	schedtest::latencyHistogram latency;
+	std::vector<schedtest::latencyHistogram> queueLatency(opts.queues);
+	schedtest::latencyHistogram makespan;
+	schedtest::latencyHistogram criticalPath;
+	drm_sched_test_microbench microbench = {};
+	for (const result &res : results) {
+		microbench.alloc_ns += res.microbench.alloc_ns;
+		microbench.init_ns += res.microbench.init_ns;
+		microbench.deps_ns += res.microbench.deps_ns;
+		microbench.push_ns += res.microbench.push_ns;
+		microbench.wait_ns = std::max(microbench.wait_ns, res.microbench.wait_ns);
+		microbench.total_ns = std::max(microbench.total_ns, res.microbench.total_ns);
+		makespan.merge(res.makespan);
+		criticalPath.merge(res.criticalPath);
+		start = std::min(start, res.start);
+		end = std::max(end, res.end);
+		jobs += res.jobs;
+		for (unsigned slot = 0; slot < opts.queues; slot++) {
+			latency.merge(res.latency[slot]);
+			queueLatency[slot].merge(res.latency[slot]);
+		}
+	}
+	const double elapsed = std::chrono::duration<double, std::micro>(end - start).count();
+
+	json << "{\"workload\": \"" << opts.workload << "\", \"threads\": " << opts.threads
+	     << ", \"fd_model\": \"" << (opts.sharedFd ? "shared" : "per-thread") << "\""
+	     << ", \"first_queue\": " << opts.first << ", \"queues\": " << opts.queues
+	     << ", \"batch\": " << opts.batch
+	     << ", \"syncobj\": \"" << (opts.timeline ? "timeline" : (opts.pooled ? "binary-pooled" : "binary")) << "\""
+	     << ", \"abandon\": " << (opts.abandon ? "true" : "false");
+	if (opts.workload == "open")
+		json << ", \"arrival\": \"" << (opts.poisson ? "poisson" : "fixed") << "\", \"offered_rate\": " << opts.rate;
+	if (opts.workload == "dag")
+		json << ", \"fan\": " << opts.fan << ", \"join\": \"" << (opts.chainJoin ? "chained" : "multi-fence") << "\"";
+	json << ", \"jobs\": " << jobs << ", \"elapsed_us\": " << elapsed
+	     << ", \"iops\": " << (jobs * 1000000.0) / elapsed
+	     << ", \"us_per_job\": " << elapsed / jobs
+	     << ", \"hwemu_cpu_percent\": " << ((hwemuEnd - hwemuStart) * 1000000.0 * 100.0) / elapsed;
+	if (opts.workload == "kernel") {
+		// Summed over the workers, the wait and total times are the longest of any worker
+		json << ", \"pattern\": \"" << (opts.chainJoin ? "chain" : "independent") << "\""
+		     << ", \"kernel_ns_per_job\": {\"alloc\": " << (double)microbench.alloc_ns / jobs
+		     << ", \"init\": " << (double)microbench.init_ns / jobs
+		     << ", \"deps\": " << (double)microbench.deps_ns / jobs
+		     << ", \"push\": " << (double)microbench.push_ns / jobs << "}"
+		     << ", \"kernel_wait_us\": " << microbench.wait_ns / 1000.0
+		     << ", \"kernel_total_us\": " << microbench.total_ns / 1000.0;
+	}
+	if (opts.workload == "random") {
+		// The DAG is built from the seed alone, so every worker ran this one
+		const randomDag dag = buildDag(opts);
+		const double cpJobs = dag.criticalPath.size();
+		json << ", \"dag\": {\"width\": " << opts.width << ", \"depth\": " << opts.depth
+		     << ", \"fan_in\": " << opts.fanIn << ", \"fan_out\": " << opts.fanOut
+		     << ", \"cross_ratio\": " << opts.crossRatio << ", \"seed\": " << opts.seed
+		     << ", \"nodes\": " << dag.nodes.size() << ", \"edges\": " << dag.edges
+		     << ", \"cross_edges\": " << dag.crossEdges << ", \"critical_path_jobs\": " << cpJobs << "}";
+		json << ", \"critical_path_us\": ";
+		writeLatency(json, criticalPath);
+		json << ", \"makespan_us\": ";
+		writeLatency(json, makespan);
+		/*
+		 * Efficiency is 1 when a DAG instance completes as fast as its critical path alone;
+		 * achieved parallelism is the number of jobs kept in flight at the critical path's
+		 * per-job pace, against the available parallelism of nodes per critical path job
+		 */
+		json << ", \"efficiency\": " << criticalPath.mean() / makespan.mean()
+		     << ", \"parallelism\": {\"available\": " << dag.nodes.size() / cpJobs
+		     << ", \"achieved\": " << (dag.nodes.size() * criticalPath.mean() / cpJobs) / makespan.mean() << "}";
+	}
+	if (latency.count()) {
+		json << ", \"latency_us\": ";
+		writeLatency(json, latency);
+		json << ", \"queue_latency_us\": {";
+		for (unsigned slot = 0; slot < opts.queues; slot++) {
+			json << (slot ? ", " : "") << "\"" << opts.first + slot << "\": ";
+			writeLatency(json, queueLatency[slot]);
+		}
+		json << "}";
+	}
+	json << ", \"per_thread\": [";
+	for (unsigned t = 0; t < opts.threads; t++) {
+		const double threadElapsed = std::chrono::duration<double, std::micro>(results[t].end - results[t].start).count();
+		json << (t ? ", " : "") << "{\"jobs\": " << results[t].jobs << ", \"elapsed_us\": " << threadElapsed
+		     << ", \"iops\": " << (threadElapsed ? (results[t].jobs * 1000000.0) / threadElapsed : 0) << "}";
+	}
+	json << "]}";
+	return elapsed / jobs;
+}
+
+static void usage(const char *cmd)
+{
+	std::cout << "Usage " << cmd << " [-n <dev_node>] [-w pipelined|sync|chain|dag|open|random|kernel] [-t <threads>] [-S]\n"
+		  << "       [-c <count>] [-b <batch>] [-Q <first_queue>] [-q <queues>] [-s] [-p] [-a]\n"
+		  << "       [-f <fan>] [-x] [-H] [-I] [-m <model>[,<param0_ns>[,<param1_ns>[,<permille>]]]]\n"
+		  << "       [-r <rate>[,<rate>...]] [-F] [-W <width>] [-D <depth>] [-i <fan_in>] [-O <fan_out>]\n"
+		  << "       [-X <cross_ratio>] [-z <seed>] [-o <json_file>]\n"
+		  << "  -w  workload, default pipelined\n"
+		  << "  -t  number of worker threads\n"
+		  << "  -S  all workers share one device fd instead of one fd per worker\n"
+		  << "  -c  jobs per worker, DAG rounds or instances per worker for dag and random\n"
+		  << "  -b  jobs per submit ioctl (pipelined) or per round trip (sync)\n"
+		  << "  -Q  first queue used, -q number of queues used from there\n"
+		  << "  -s  one binary syncobj per job instead of timeline points (pipelined and sync)\n"
+		  << "  -p  create and destroy binary syncobjs instead of recycling them from a pool\n"
+		  << "  -a  abandon the jobs to the driver's cleanup on close instead of waiting\n"
+		  << "  -f  fan-out of the dag workload, -x to build its join from a chain of jobs\n"
+		  << "  -x  also makes every job of the kernel workload depend on the previous one\n"
+		  << "  -H  run on queue A and then on the fast queue B and report the HW emulation handoff cost\n"
+		  << "  -I  complete jobs from the hrtimer backend instead of the HW emulation thread\n"
+		  << "  -m  service time model of the emulated HW\n"
+		  << "  -r  offered rates of the open workload in jobs/s over all workers, one run per rate\n"
+		  << "  -F  fixed interarrival times for the open workload instead of Poisson arrivals\n"
+		  << "  -W  width, -D depth, -i maximum fan-in and -O maximum fan-out of the random DAG\n"
+		  << "  -X  fraction of the random DAG's edges crossing queues\n"
+		  << "  -z  seed of the random generators\n"
+		  << "  -o  write the JSON results to a file instead of stdout\n";
+	throw std::invalid_argument("");
+}
+
+int main(int argc, char *argv[])
+{
+	try {
+		options opts;
+		char c = '\0';
+		while ((c = getopt (argc, argv, "n:w:t:Sc:b:Q:q:spaf:xHIm:r:FW:D:i:O:X:z:o:")) != -1) {
+			switch (c) {
+			case 'n':
+				opts.minor = std::atoi(optarg);
+				break;
+			case 'w':
+				opts.workload = optarg;
+				break;
+			case 't':
+				opts.threads = std::atoi(optarg);
+				break;
+			case 'S':
+				opts.sharedFd = true;
+				break;
+			case 'c':
+				opts.count = std::atoi(optarg);
+				break;
+			case 'b':
+				opts.batch = std::atoi(optarg);
+				break;
+			case 'Q':
+				opts.first = std::atoi(optarg);
+				break;
+			case 'q':
+				opts.queues = std::atoi(optarg);
+				break;
+			case 's':
+				opts.timeline = false;
+				break;
+			case 'p':
+				opts.pooled = false;
+				break;
+			case 'a':
+				opts.abandon = true;
+				break;
+			case 'f':
+				opts.fan = std::atoi(optarg);
+				break;
+			case 'x':
+				opts.chainJoin = true;
+				break;
+			case 'H':
+				opts.handoff = true;
+				break;
+			case 'I':
+				opts.irq = true;
+				break;
+			case 'm':
+				opts.service = optarg;
+				break;
+			case 'r': {
+				std::istringstream rates(optarg);
+				std::string rate;
+				while (std::getline(rates, rate, ','))
+					opts.rates.push_back(std::stod(rate));
+				break;
+			}
+			case 'F':
+				opts.poisson = false;
+				break;
+			case 'W':
+				opts.width = std::atoi(optarg);
+				break;
+			case 'D':
+				opts.depth = std::atoi(optarg);
+				break;
+			case 'i':
+				opts.fanIn = std::atoi(optarg);
+				break;
+			case 'O':
+				opts.fanOut = std::atoi(optarg);
+				break;
+			case 'X':
+				opts.crossRatio = std::stod(optarg);
+				break;
+			case 'z':
+				opts.seed = std::atoi(optarg);
+				break;
+			case 'o':
+				opts.output = optarg;
+				break;
+			case '?':
+			default:
+				usage(argv[0]);
+			}
+		}
+		const unsigned numQueues = schedtest::numQueues();
+		if ((optind < argc) || !opts.threads || (opts.count < 1) || (opts.batch < 1) || !opts.queues ||
+		    (opts.first + opts.queues > numQueues) || !opts.fan || (opts.fan > SCHED_TEST_MAX_IN_FENCES) ||
+		    (opts.handoff && (numQueues <= SCHED_TSTQ_B)) ||
+		    ((opts.workload == "open") && (opts.rates.empty() || !opts.timeline || opts.handoff)) ||
+		    (std::find_if(opts.rates.begin(), opts.rates.end(), [](double rate) { return rate <= 0; }) !=
+		     opts.rates.end()) ||
+		    !opts.width || !opts.depth || !opts.fanIn || (opts.fanIn > SCHED_TEST_MAX_IN_FENCES) ||
+		    !opts.fanOut || (opts.crossRatio < 0) || (opts.crossRatio > 1) ||
+		    ((opts.workload != "pipelined") && (opts.workload != "sync") && (opts.workload != "chain") &&
+		     (opts.workload != "dag") && (opts.workload != "open") && (opts.workload != "random") &&
+		     (opts.workload != "kernel"))) {
+			usage(argv[0]);
+		}
+
+		// The emulated HW configuration is device wide, set it up once for all the workers
+		schedtest::queueConfig hwConfig(opts.minor);
+		if (!opts.service.empty() || opts.irq) {
+			drm_sched_test_queue_config config = schedtest::parseServiceModel(opts.service.empty() ? "nop" : opts.service);
+			config.backend = opts.irq ? SCHED_TEST_BACKEND_HRTIMER : SCHED_TEST_BACKEND_KTHREAD;
+			for (unsigned qu = opts.first; qu < opts.first + opts.queues; qu++)
+				hwConfig.configure(static_cast<sched_test_queue>(qu), config);
+		}
+
+		std::ofstream file;
+		if (!opts.output.empty()) {
+			file.open(opts.output);
+			if (!file)
+				throw std::system_error(errno, std::generic_category(), opts.output);
+		}
+		std::ostream &json = opts.output.empty() ? std::cout : file;
+		json << "{\"benchmark\": \"sched_test\", \"service_model\": \""
+		     << (opts.service.empty() ? "nop" : opts.service) << "\", \"backend\": \""
+		     << (opts.irq ? "hrtimer" : "kthread") << "\", \"hwemu_poll_us\": \""
+		     << schedtest::moduleParam("hwemu_poll_us") << "\", \"bypass_queues\": \""
+		     << schedtest::moduleParam("bypass_queues") << "\", \"runs\": [";
+		if (opts.handoff) {
+			/*
+			 * Queue A hands every job to its HW emulation thread, the fast queue B completes
+			 * it inline in run_job; the difference is the cost of the kthread handoff
+			 */
+			options regular = opts;
+			regular.first = SCHED_TSTQ_A;
+			regular.queues = 1;
+			options fast = regular;
+			fast.first = SCHED_TSTQ_B;
+			const double regularUs = runAll(regular, json);
+			json << ", ";
+			const double fastUs = runAll(fast, json);
+			json << "], \"drm_sched_us_per_job\": " << fastUs << ", \"handoff_us_per_job\": "
+			     << regularUs - fastUs << "}" << std::endl;
+		} else if (opts.workload == "open") {
+			// The runs at increasing offered rates make up the latency versus load curve
+			for (size_t i = 0; i < opts.rates.size(); i++) {
+				options run = opts;
+				run.rate = opts.rates[i];
+				json << (i ? ", " : "");
+				runAll(run, json);
+			}
+			json << "]}" << std::endl;
+		} else {
+			runAll(opts, json);
+			json << "]}" << std::endl;
+		}
+
+	} catch (std::exception &ex) {
+		std::cerr << ex.what() << std::endl;
+		return 1;
+	}
+	return 0;
+}
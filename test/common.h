@@ -11,21 +11,106 @@
 #include <fcntl.h>
 #include <xf86drm.h>
 #include <sys/ioctl.h>
+#include <sys/wait.h>
 #include <unistd.h>
+#include <dirent.h>
+#include <spawn.h>
+#include <signal.h>
 
+#include <algorithm>
 #include <iostream>
+#include <fstream>
+#include <sstream>
 #include <string>
 #include <cerrno>
 #include <cstring>
+#include <cstdint>
+#include <cstdlib>
+#include <ctime>
 #include <system_error>
+#include <stdexcept>
+#include <vector>
+
+#include "sched_test.h"
 
 namespace schedtest {
 
+// Number of syncobjs the tests reap with one wait ioctl
+static const size_t reapChunk = 4096;
+
+class syncobj;
+
+/*
+ * Pool of binary syncobj handles. Handles are created upfront, syncobjs handed out by
+ * get() go back to the pool when they are destroyed, and returned handles are recycled
+ * with one drmSyncobjReset call for all of them when the pool runs dry. This keeps the
+ * syncobj create and destroy ioctls out of the measured loop of a test.
+ */
+class syncobjPool {
+	const int _fd;
+	const std::string _nodeName;
+	// Every handle owned by the pool, the ones ready for use and the ones waiting for reset
+	std::vector<unsigned int> _all;
+	std::vector<unsigned int> _free;
+	std::vector<unsigned int> _dirty;
+
+	void grow(size_t count) {
+		for (size_t i = 0; i < count; i++) {
+			unsigned int handle;
+			int result = drmSyncobjCreate(_fd, 0, &handle);
+			if (result < 0)
+				throw std::system_error(errno, std::generic_category(), _nodeName);
+			_all.push_back(handle);
+			_free.push_back(handle);
+		}
+	}
+	void recycle() {
+		int result = drmSyncobjReset(_fd, _dirty.data(), _dirty.size());
+		if (result < 0)
+			throw std::system_error(errno, std::generic_category(), _nodeName);
+		_free.insert(_free.end(), _dirty.begin(), _dirty.end());
+		_dirty.clear();
+	}
+public:
+	syncobjPool(int fd, const std::string &nodeName, size_t size) : _fd(fd), _nodeName(nodeName) {
+		_all.reserve(size);
+		_free.reserve(size);
+		_dirty.reserve(size);
+		grow(size);
+	}
+	syncobjPool(const syncobjPool &other) = delete;
+	~syncobjPool() {
+		for (unsigned int handle : _all)
+			drmSyncobjDestroy(_fd, handle);
+	}
+	unsigned int acquire() {
+		if (_free.empty()) {
+			if (_dirty.empty())
+				grow(std::max<size_t>(_all.size(), 16));
+			else
+				recycle();
+		}
+		unsigned int handle = _free.back();
+		_free.pop_back();
+		return handle;
+	}
+	void release(unsigned int handle) {
+		_dirty.push_back(handle);
+	}
+	int fd() const {
+		return _fd;
+	}
+	const std::string &nodeName() const {
+		return _nodeName;
+	}
+	syncobj get();
+};
+
 class syncobj {
-	static const long long _delay = 10000ll;
 	const unsigned _fd;
 	const std::string _nodeName;
 	unsigned int _handle;
+	syncobjPool *_pool = nullptr;
 public:
 	syncobj() : _fd(0xffffffff), _handle(0) {
 	}
@@ -35,9 +120,17 @@ public:
 		if (result < 0)
 			throw std::system_error(errno, std::generic_category(), _nodeName);
 	}
+	// A syncobj borrowed from the pool, handed back to it on destruction
+	syncobj(syncobjPool &pool) : _fd(pool.fd()), _nodeName(pool.nodeName()), _handle(pool.acquire()),
+				     _pool(&pool) {
+	}
 	~syncobj() {
 		if (!_handle)
 			return;
+		if (_pool) {
+			_pool->release(_handle);
+			return;
+		}
 		int result = drmSyncobjDestroy(_fd, _handle);
 		if (result < 0) {
 			// Cannot throw in the destructor, so print out the error :-(
@@ -48,7 +141,8 @@ public:
 	}
 	syncobj(syncobj &&other) : _fd(other._fd),
 				   _nodeName(std::move(other._nodeName)),
-				   _handle(other._handle) {
+				   _handle(other._handle),
+				   _pool(other._pool) {
 		other._handle = 0;
 	}
 	void reset() {
@@ -56,26 +150,337 @@ public:
 		if (result < 0)
 			throw std::system_error(errno, std::generic_category(), _nodeName);
 	}
+	// Wait for a binary syncobj to signal
 	void wait() const {
-		unsigned int handles[4];
-		handles[0] = _handle;
-		int result, c;
-		for (c = 1; c <= 1000; c++) {
-			result = drmSyncobjWait(_fd, handles, 1, _delay, 0, nullptr);
-			if (result == -ETIME)
-				continue;
-			if (result <= 0)
-				break;
-		}
-		std::cout << "Total wait: " << (c * _delay) / 1000 << " us\n";
+		unsigned int handle = _handle;
+		int result = drmSyncobjWait(_fd, &handle, 1, INT64_MAX, 0, nullptr);
 		if (result < 0)
-			throw std::system_error(errno, std::generic_category(), _nodeName);
+			throw std::system_error(-result, std::generic_category(), _nodeName);
+	}
+	// Wait for a point of a timeline syncobj
+	void wait(uint64_t point) const {
+		unsigned int handle = _handle;
+		int result = drmSyncobjTimelineWait(_fd, &handle, &point, 1, INT64_MAX, 0, nullptr);
+		if (result < 0)
+			throw std::system_error(-result, std::generic_category(), _nodeName);
 	}
 	int operator()() const {
 		return _handle;
 	}
 };
 
+inline syncobj syncobjPool::get()
+{
+	return syncobj(*this);
+}
+
+// Absolute CLOCK_MONOTONIC deadline in ns, timeoutNs from now, as the syncobj waits expect it
+inline int64_t deadlineIn(int64_t timeoutNs)
+{
+	timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000000ll + now.tv_nsec + timeoutNs;
+}
+
+/*
+ * Set of syncobjs, or points of timeline syncobjs, waited on with a single wait ioctl.
+ * Binary and timeline syncobjs cannot be mixed in one set; a set with any non-zero point
+ * is waited on as timelines. Deadlines are absolute CLOCK_MONOTONIC times in ns, see
+ * deadlineIn().
+ */
+class waitset {
+	const int _fd;
+	const std::string _nodeName;
+	std::vector<uint32_t> _handles;
+	std::vector<uint64_t> _points;
+	bool _timeline = false;
+
+	int wait(int64_t deadline, uint32_t flags, uint32_t *first) {
+		int result;
+		if (_timeline)
+			result = drmSyncobjTimelineWait(_fd, _handles.data(), _points.data(), _handles.size(),
+							deadline, flags, first);
+		else
+			result = drmSyncobjWait(_fd, _handles.data(), _handles.size(), deadline, flags, first);
+		if ((result < 0) && (result != -ETIME))
+			throw std::system_error(-result, std::generic_category(), _nodeName);
+		return result;
+	}
+public:
+	waitset(int fd, const std::string &nodeName, size_t size = 0) : _fd(fd), _nodeName(nodeName) {
+		_handles.reserve(size);
+		_points.reserve(size);
+	}
+	void add(const syncobj &sobj, uint64_t point = 0) {
+		_handles.push_back(sobj());
+		_points.push_back(point);
+		_timeline |= (point != 0);
+	}
+	void clear() {
+		_handles.clear();
+		_points.clear();
+		_timeline = false;
+	}
+	size_t size() const {
+		return _handles.size();
+	}
+	// Waits for all of the set to signal, returns false if the deadline passed first
+	bool waitAll(int64_t deadline = INT64_MAX) {
+		if (_handles.empty())
+			return true;
+		return wait(deadline, DRM_SYNCOBJ_WAIT_FLAGS_WAIT_ALL, nullptr) != -ETIME;
+	}
+	// Waits for any of the set to signal, returns the index of a signaled one or -1 if the deadline passed
+	int waitAny(int64_t deadline = INT64_MAX) {
+		uint32_t first = 0;
+		if (_handles.empty() || (wait(deadline, 0, &first) == -ETIME))
+			return -1;
+		return first;
+	}
+};
+
+/*
+ * Returns the CPU time in seconds consumed so far by all the HW emulation kernel threads
+ * (HW_TSTQ_*), used to report the CPU cost of the driver's busy-poll mode
+ */
+inline double hwemuCpuTime()
+{
+	const double tick = sysconf(_SC_CLK_TCK);
+	double total = 0;
+	DIR *dir = opendir("/proc");
+	if (!dir)
+		return 0;
+	while (dirent *entry = readdir(dir)) {
+		const std::string base = std::string("/proc/") + entry->d_name;
+		std::string comm;
+		std::ifstream commFile(base + "/comm");
+		if (!(commFile >> comm) || comm.compare(0, 8, "HW_TSTQ_"))
+			continue;
+		std::ifstream statFile(base + "/stat");
+		std::string stat;
+		std::getline(statFile, stat);
+		// Fields after the "(comm)" start with state (field 3); utime and stime are fields 14 and 15
+		std::istringstream fields(stat.substr(stat.rfind(')') + 1));
+		std::string field;
+		unsigned long utime = 0, stime = 0;
+		for (int i = 3; (i <= 15) && (fields >> field); i++) {
+			if (i == 14)
+				utime = std::stoul(field);
+			else if (i == 15)
+				stime = std::stoul(field);
+		}
+		total += (utime + stime) / tick;
+	}
+	closedir(dir);
+	return total;
+}
+
+// Returns the value of a sched_test module parameter or an empty string if it cannot be read
+inline std::string moduleParam(const std::string &name)
+{
+	std::ifstream param("/sys/module/sched_test/parameters/" + name);
+	std::string value;
+	param >> value;
+	return value;
+}
+
+// Options shared by the tests, each test sets its own defaults
+struct testOptions {
+	unsigned int minor = 128;
+	int count = 0;
+	int jobs = 1;
+	int window = 1;
+	std::string service;
+};
+
+/*
+ * Handles an option common to the tests, returns false for any other one: -n <dev_node>,
+ * -c <loop_count>, -j <processes>, -w <window> and -m <service time model>
+ */
+inline bool parseTestOption(int c, const char *arg, testOptions &opts)
+{
+	switch (c) {
+	case 'n':
+		opts.minor = std::atoi(arg);
+		return true;
+	case 'c':
+		opts.count = std::atoi(arg);
+		return true;
+	case 'j':
+		opts.jobs = std::atoi(arg);
+		return true;
+	case 'w':
+		opts.window = std::atoi(arg);
+		return true;
+	case 'm':
+		opts.service = arg;
+		return true;
+	default:
+		return false;
+	}
+}
+
+/*
+ * Processes running the test binary cmd again with args, to load the device from several
+ * processes. Children which were not waited for are killed when the object goes away.
+ */
+class children {
+	std::vector<pid_t> _pids;
+public:
+	children(const std::string &cmd, const std::vector<std::string> &args, int count, const std::string &label,
+		 bool quiet = false) {
+		posix_spawn_file_actions_t actions;
+		int result = posix_spawn_file_actions_init(&actions);
+		if (!result)
+			result = posix_spawn_file_actions_addclose(&actions, STDIN_FILENO);
+		if (!result && quiet)
+			result = posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+		std::vector<char *> argv(1, const_cast<char *>(cmd.c_str()));
+		for (const std::string &arg : args)
+			argv.push_back(const_cast<char *>(arg.c_str()));
+		argv.push_back(nullptr);
+		for (int i = 1; !result && (i <= count); i++) {
+			pid_t pid;
+			result = posix_spawn(&pid, cmd.c_str(), &actions, nullptr, argv.data(), nullptr);
+			if (!result) {
+				std::cout << label << "[" << i << "]: " << pid << std::endl;
+				_pids.push_back(pid);
+			}
+		}
+		posix_spawn_file_actions_destroy(&actions);
+		if (result) {
+			kill();
+			throw std::system_error(result, std::generic_category(), cmd);
+		}
+	}
+	children(const children &) = delete;
+	children &operator=(const children &) = delete;
+	~children() {
+		kill();
+	}
+	// Waits for all the children to exit
+	void wait() {
+		for (pid_t pid : _pids) {
+			int status;
+			while ((waitpid(pid, &status, 0) < 0) && (errno == EINTR))
+				;
+		}
+		_pids.clear();
+	}
+	void kill() {
+		for (pid_t pid : _pids)
+			::kill(pid, SIGKILL);
+		wait();
+	}
+};
+
+/*
+ * Parses an emulated HW service time model given as <model>[,<param0_ns>[,<param1_ns>[,<permille>]]]
+ * where model is one of nop, fixed, uniform, exp or bimodal
+ */
+inline drm_sched_test_queue_config parseServiceModel(const std::string &spec)
+{
+	static const char *const models[SCHED_TEST_SERVICE_MAX] = {"nop", "fixed", "uniform", "exp", "bimodal"};
+	drm_sched_test_queue_config config = {};
+	std::istringstream fields(spec);
+	std::string field;
+
+	std::getline(fields, field, ',');
+	while ((config.model < SCHED_TEST_SERVICE_MAX) && (field != models[config.model]))
+		config.model++;
+	if (config.model == SCHED_TEST_SERVICE_MAX)
+		throw std::invalid_argument(spec);
+	if (std::getline(fields, field, ','))
+		config.param0_ns = std::stoull(field);
+	if (std::getline(fields, field, ','))
+		config.param1_ns = std::stoull(field);
+	if (std::getline(fields, field, ','))
+		config.permille = std::stoul(field);
+	return config;
+}
+
+// Returns the p-th percentile (0 < p <= 100) of the samples, reorders the samples
+inline double percentile(std::vector<double> &samples, double p)
+{
+	if (samples.empty())
+		return 0;
+	const size_t k = std::min(samples.size() - 1, static_cast<size_t>((p / 100.0) * samples.size()));
+	std::nth_element(samples.begin(), samples.begin() + k, samples.end());
+	return samples[k];
+}
+
+/*
+ * Log-linear histogram of latencies in ns: values below 64 get a bucket each, above that
+ * every power of two is split into 32 linear sub-buckets, so a bucket is at most ~3% wide.
+ * All buckets are allocated upfront and record() does no allocation.
+ */
+class latencyHistogram {
+	static const unsigned subBits = 5;
+	static const unsigned subBuckets = 1 << subBits;
+	std::vector<uint64_t> _counts;
+	uint64_t _count = 0;
+	uint64_t _sum = 0;
+	uint64_t _max = 0;
+
+	static unsigned index(uint64_t ns) {
+		if (ns < 2 * subBuckets)
+			return ns;
+		const unsigned shift = 63 - __builtin_clzll(ns) - subBits;
+		return shift * subBuckets + (ns >> shift);
+	}
+	// Highest value falling into bucket i
+	static uint64_t upperBound(unsigned i) {
+		if (i < 2 * subBuckets)
+			return i;
+		const unsigned shift = i / subBuckets - 1;
+		const uint64_t mantissa = i % subBuckets + subBuckets;
+		return ((mantissa + 1) << shift) - 1;
+	}
+public:
+	latencyHistogram() : _counts((64 - subBits + 1) * subBuckets, 0) {
+	}
+	void record(uint64_t ns) {
+		_counts[index(ns)]++;
+		_count++;
+		_sum += ns;
+		_max = std::max(_max, ns);
+	}
+	void merge(const latencyHistogram &other) {
+		for (size_t i = 0; i < _counts.size(); i++)
+			_counts[i] += other._counts[i];
+		_count += other._count;
+		_sum += other._sum;
+		_max = std::max(_max, other._max);
+	}
+	uint64_t count() const {
+		return _count;
+	}
+	uint64_t max() const {
+		return _max;
+	}
+	double mean() const {
+		return _count ? (double)_sum / _count : 0;
+	}
+	// Returns the upper bound of the bucket holding the p-th percentile (0 < p <= 100)
+	uint64_t percentile(double p) const {
+		const uint64_t rank = std::min(_count, static_cast<uint64_t>((p / 100.0) * _count) + 1);
+		uint64_t seen = 0;
+		for (size_t i = 0; i < _counts.size(); i++) {
+			seen += _counts[i];
+			if (seen >= rank)
+				return std::min(upperBound(i), _max);
+		}
+		return _max;
+	}
+};
+
+// Returns the number of queues the sched_test driver was loaded with
+inline unsigned numQueues()
+{
+	const std::string value = moduleParam("num_queues");
+	return value.empty() ? SCHED_TSTQ_MAX : std::stoul(value);
+}
+
 class raii {
 	const int _fd;
 	const std::string _nodeName;
@@ -110,6 +515,90 @@ public:
 	syncobj createSyncobj() const {
 		return syncobj(_fd, _nodeName);
 	}
+	waitset createWaitset(size_t size = 0) const {
+		return waitset(_fd, _nodeName, size);
+	}
+	// Pool of size binary syncobjs created upfront, see syncobjPool
+	syncobjPool createPool(size_t size) const {
+		return syncobjPool(_fd, _nodeName, size);
+	}
+	// Set the service time model of the emulated HW behind a queue, this affects all clients
+	void configureQueue(sched_test_queue qu, drm_sched_test_queue_config config) const {
+		config.qu = qu;
+		callIoctl(DRM_IOCTL_SCHED_TEST_QUEUE_CONFIG, &config);
+	}
+	// Read the last signaled point of each timeline syncobj with one DRM_IOCTL_SYNCOBJ_QUERY call
+	void queryTimelines(std::vector<uint32_t> &handles, std::vector<uint64_t> &points) const {
+		int result = drmSyncobjQuery(_fd, handles.data(), points.data(), handles.size());
+		if (result < 0)
+			throw std::system_error(errno, std::generic_category(), _nodeName);
+	}
+	// Submit all the commands with one DRM_IOCTL_SCHED_TEST_SUBMIT_BATCH call
+	void submitBatch(std::vector<drm_sched_test_submit> &cmds) const {
+		drm_sched_test_submit_batch batch = {reinterpret_cast<uintptr_t>(cmds.data()),
+			static_cast<__u32>(cmds.size()), sizeof(drm_sched_test_submit)};
+		callIoctl(DRM_IOCTL_SCHED_TEST_SUBMIT_BATCH, &batch);
+	}
+};
+
+/*
+ * Configures the emulated HW behind queues for the lifetime of the object. The setting
+ * is device wide and would outlive the process, so the queues go back to the defaults,
+ * no service time on the kthread backend, when the object goes away.
+ */
+class queueConfig {
+	const int _node;
+	std::vector<sched_test_queue> _queues;
+public:
+	queueConfig(const int node) : _node(node) {}
+	queueConfig(const queueConfig &) = delete;
+	queueConfig &operator=(const queueConfig &) = delete;
+	~queueConfig() {
+		if (_queues.empty())
+			return;
+		try {
+			const raii f(_node);
+			for (sched_test_queue qu : _queues)
+				f.configureQueue(qu, drm_sched_test_queue_config());
+		} catch (std::exception &ex) {
+			std::cerr << "Restoring the queue configuration: " << ex.what() << std::endl;
+		}
+	}
+	void configure(sched_test_queue qu, const drm_sched_test_queue_config &config) {
+		const raii f(_node);
+		_queues.push_back(qu);
+		f.configureQueue(qu, config);
+	}
+};
+
+/*
+ * Pins the drm_sched and HW emulation threads of a queue to CPUs, see
+ * SCHED_TEST_QUEUE_CONFIG_AFFINITY, and lets them float again on destruction
+ */
+class queueAffinity {
+	const raii &_f;
+	const sched_test_queue _qu;
+
+	static drm_sched_test_queue_config affinity(int hwemu, int sched) {
+		drm_sched_test_queue_config config = {};
+		config.flags = SCHED_TEST_QUEUE_CONFIG_AFFINITY;
+		config.hwemu_cpu = hwemu;
+		config.sched_cpu = sched;
+		return config;
+	}
+public:
+	queueAffinity(const raii &f, sched_test_queue qu, int hwemu, int sched) : _f(f), _qu(qu) {
+		_f.configureQueue(_qu, affinity(hwemu, sched));
+	}
+	queueAffinity(const queueAffinity &) = delete;
+	queueAffinity &operator=(const queueAffinity &) = delete;
+	~queueAffinity() {
+		try {
+			_f.configureQueue(_qu, affinity(-1, -1));
+		} catch (std::exception &ex) {
+			std::cerr << "Restoring the queue affinity: " << ex.what() << std::endl;
+		}
+	}
 };
 
 }
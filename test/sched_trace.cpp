@@ -0,0 +1,268 @@
+/* SPDX-License-Identifier: LGPL-2.1 OR MIT */
+/*
+ * Copyright (C) 2023 Advanced Micro Devices, Inc.
+ * Authors:
+ *     Sonal Santan <sonal.santan@amd.com>
+ */
+
+#include <unistd.h>
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <system_error>
+#include <stdexcept>
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+#include <map>
+#include <vector>
+#include <utility>
+
+#include "common.h"
+
+/*
+ * Reads the sched_test job lifecycle tracepoints from tracefs and breaks the life of every
+ * job down into its stages: submit ioctl, push to the entity, run_job, emulated HW dequeue,
+ * irq fence signal and free_job.
+ */
+
+namespace {
+
+const std::string tracefs = "/sys/kernel/tracing/";
+
+enum stage {
+	STAGE_SUBMIT,
+	STAGE_PUSH,
+	STAGE_RUN,
+	STAGE_HW_DEQUEUE,
+	STAGE_SIGNAL,
+	STAGE_FREE,
+	STAGE_MAX
+};
+
+const char *const stageNames[STAGE_MAX] = {"submit", "push", "run", "hw_dequeue", "signal", "free"};
+
+struct job {
+	unsigned qu = 0;
+	unsigned deps = 0;
+	// Timestamps in us, negative when the event was not seen
+	double ts[STAGE_MAX] = {-1, -1, -1, -1, -1, -1};
+};
+
+void writeTracefs(const std::string &file, const std::string &value)
+{
+	std::ofstream out(tracefs + file);
+	out << value << std::endl;
+	if (!out)
+		throw std::system_error(errno, std::generic_category(), tracefs + file);
+}
+
+/*
+ * Parses one line of the trace, which looks like
+ * "  <comm>-<pid>  [003] .....  1234.567890: sched_test_run: qu=0 ctx=12 seqno=3"
+ * and returns false for lines which are not sched_test job events
+ */
+bool parseLine(const std::string &line, std::string &event, double &ts, std::map<std::string, uint64_t> &fields)
+{
+	const size_t pos = line.find(": sched_test_");
+	if (pos == std::string::npos)
+		return false;
+	const size_t tsPos = line.rfind(' ', pos);
+	if (tsPos == std::string::npos)
+		return false;
+	ts = std::stod(line.substr(tsPos + 1, pos - tsPos - 1)) * 1000000.0;
+	const size_t eventEnd = line.find(':', pos + 2);
+	if (eventEnd == std::string::npos)
+		return false;
+	event = line.substr(pos + 2 + std::strlen("sched_test_"), eventEnd - pos - 2 - std::strlen("sched_test_"));
+
+	std::istringstream tokens(line.substr(eventEnd + 1));
+	std::string token;
+	fields.clear();
+	while (tokens >> token) {
+		const size_t eq = token.find('=');
+		if (eq != std::string::npos)
+			fields[token.substr(0, eq)] = std::stoull(token.substr(eq + 1), nullptr, 0);
+	}
+	return true;
+}
+
+void report(const std::map<std::pair<uint64_t, uint64_t>, job> &jobs, unsigned timeline)
+{
+	// Latency of every stage from the previous stage seen, per queue; index STAGE_SUBMIT is end to end
+	std::map<unsigned, std::vector<std::vector<double>>> latencies;
+	unsigned complete = 0;
+	double origin = -1;
+
+	for (const auto &entry : jobs) {
+		const job &j = entry.second;
+		std::vector<std::vector<double>> &lat = latencies[j.qu];
+		lat.resize(STAGE_MAX);
+		double prev = -1;
+		double first = -1;
+		for (int s = STAGE_SUBMIT; s < STAGE_MAX; s++) {
+			if (j.ts[s] < 0)
+				continue;
+			if (prev >= 0)
+				lat[s].push_back(j.ts[s] - prev);
+			else
+				first = j.ts[s];
+			prev = j.ts[s];
+		}
+		if ((j.ts[STAGE_SUBMIT] >= 0) && (j.ts[STAGE_FREE] >= 0)) {
+			lat[STAGE_SUBMIT].push_back(j.ts[STAGE_FREE] - j.ts[STAGE_SUBMIT]);
+			complete++;
+		}
+		if ((first >= 0) && ((origin < 0) || (first < origin)))
+			origin = first;
+	}
+
+	std::cout << "Jobs: " << jobs.size() << " Complete: " << complete << std::endl;
+	std::cout << std::fixed << std::setprecision(2);
+	for (auto &entry : latencies) {
+		std::cout << "Queue " << entry.first << " latency (us):" << std::endl;
+		std::cout << "  " << std::left << std::setw(24) << "stage" << std::right << std::setw(10) << "count"
+			  << std::setw(10) << "mean" << std::setw(10) << "p50" << std::setw(10) << "p99"
+			  << std::setw(12) << "max" << std::endl;
+		for (int s = STAGE_SUBMIT; s < STAGE_MAX; s++) {
+			std::vector<double> &samples = entry.second[s];
+			if (samples.empty())
+				continue;
+			const std::string name = (s == STAGE_SUBMIT) ? "submit->free" :
+				std::string("->") + stageNames[s];
+			double total = 0;
+			for (double v : samples)
+				total += v;
+			const double max = *std::max_element(samples.begin(), samples.end());
+			std::cout << "  " << std::left << std::setw(24) << name << std::right << std::setw(10)
+				  << samples.size() << std::setw(10) << total / samples.size()
+				  << std::setw(10) << schedtest::percentile(samples, 50)
+				  << std::setw(10) << schedtest::percentile(samples, 99)
+				  << std::setw(12) << max << std::endl;
+		}
+	}
+
+	if (!timeline)
+		return;
+	// Timestamps of the first jobs relative to the first event in the trace
+	std::cout << "Timeline (us):" << std::endl;
+	std::cout << std::setw(6) << "qu" << std::setw(10) << "ctx" << std::setw(10) << "seqno"
+		  << std::setw(6) << "deps";
+	for (int s = STAGE_SUBMIT; s < STAGE_MAX; s++)
+		std::cout << std::setw(12) << stageNames[s];
+	std::cout << std::endl;
+	for (const auto &entry : jobs) {
+		if (!timeline--)
+			break;
+		const job &j = entry.second;
+		std::cout << std::setw(6) << j.qu << std::setw(10) << entry.first.first << std::setw(10)
+			  << entry.first.second << std::setw(6) << j.deps;
+		for (int s = STAGE_SUBMIT; s < STAGE_MAX; s++) {
+			if (j.ts[s] < 0)
+				std::cout << std::setw(12) << "-";
+			else
+				std::cout << std::setw(12) << j.ts[s] - origin;
+		}
+		std::cout << std::endl;
+	}
+}
+
+void usage(const char *cmd)
+{
+	std::cout << "Usage " << cmd << " [-e | -d | [-f <trace_file>] [-t <timeline_jobs>]]\n"
+		  << "  -e  clear the trace buffer and enable the sched_test events\n"
+		  << "  -d  disable the sched_test events\n"
+		  << "  -f  trace file to analyze, default " << tracefs << "trace\n"
+		  << "  -t  print the timeline of the first timeline_jobs jobs\n";
+	throw std::invalid_argument("");
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+	try {
+		std::string traceFile = tracefs + "trace";
+		unsigned timeline = 0;
+		bool enable = false;
+		bool disable = false;
+		char c = '\0';
+		while ((c = getopt (argc, argv, "edf:t:")) != -1) {
+			switch (c) {
+			case 'e':
+				enable = true;
+				break;
+			case 'd':
+				disable = true;
+				break;
+			case 'f':
+				traceFile = optarg;
+				break;
+			case 't':
+				timeline = std::atoi(optarg);
+				break;
+			case '?':
+			default:
+				usage(argv[0]);
+			}
+		}
+		if ((optind < argc) || (enable && disable)) {
+			usage(argv[0]);
+		}
+
+		if (enable) {
+			writeTracefs("events/sched_test/enable", "0");
+			writeTracefs("trace", "");
+			writeTracefs("events/sched_test/enable", "1");
+			return 0;
+		}
+		if (disable) {
+			writeTracefs("events/sched_test/enable", "0");
+			return 0;
+		}
+
+		std::ifstream in(traceFile);
+		if (!in)
+			throw std::system_error(errno, std::generic_category(), traceFile);
+		// Jobs keyed by the fence context and seqno of their finished fence
+		std::map<std::pair<uint64_t, uint64_t>, job> jobs;
+		// Dependencies of jobs not armed yet, keyed by the job address until their submit event
+		std::map<uint64_t, unsigned> pendingDeps;
+		std::map<std::string, uint64_t> fields;
+		std::string line;
+		std::string event;
+		double ts;
+		while (std::getline(in, line)) {
+			if (!parseLine(line, event, ts, fields))
+				continue;
+			if (event == "add_dep") {
+				// A failed dependency aborts the job, whose address may be reused
+				if (fields["ret"])
+					pendingDeps.erase(fields["job"]);
+				else
+					pendingDeps[fields["job"]]++;
+				continue;
+			}
+			job &j = jobs[std::make_pair(fields["ctx"], fields["seqno"])];
+			j.qu = fields["qu"];
+			if (event == "submit") {
+				j.deps = pendingDeps[fields["job"]];
+				pendingDeps.erase(fields["job"]);
+			}
+			for (int s = STAGE_SUBMIT; s < STAGE_MAX; s++) {
+				if (event == stageNames[s]) {
+					j.ts[s] = ts;
+					break;
+				}
+			}
+		}
+		report(jobs, timeline);
+
+	} catch (std::exception &ex) {
+		std::cout << ex.what() << std::endl;
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,137 @@
+/* SPDX-License-Identifier: LGPL-2.1 OR MIT */
+/*
+ * Copyright (C) 2023 Advanced Micro Devices, Inc.
+ * Authors:
+ *     Sonal Santan <sonal.santan@amd.com>
+ */
+
+#include <drm/drm.h>
+#include <unistd.h>
+
+#include <iostream>
+#include <system_error>
+#include <cerrno>
+#include <cstring>
+#include <utility>
+#include <vector>
+#include <deque>
+#include <chrono>
+
+#include "sched_test.h"
+#include "common.h"
+
+void run(const int node, int count, int window, bool balanced)
+{
+	/*
+	 * Keeps up to window jobs in flight, waiting for the oldest job before submitting
+	 * the next one, and records the submit to completion latency of every job
+	 * Static mode submits everything to SCHED_TSTQ_A, which is what a client bound to a
+	 * single queue does; balanced mode lets drm_sched pick the least loaded queue
+	 */
+	const schedtest::raii f(node);
+	f.showVersion();
+	/*
+	 * Keep the syncobj create and destroy ioctls out of the measured loop, with twice the
+	 * window the reaped syncobjs are reset in batches of window
+	 */
+	schedtest::syncobjPool pool(f.createPool(2 * window));
+	std::deque<std::pair<std::chrono::high_resolution_clock::time_point, schedtest::syncobj>> inflight;
+	std::vector<double> latencies;
+	latencies.reserve(count);
+
+	auto reap = [&inflight, &latencies]() {
+			    inflight.front().second.wait();
+			    auto done = std::chrono::high_resolution_clock::now();
+			    latencies.push_back(std::chrono::duration<double, std::micro>(done - inflight.front().first).count());
+			    inflight.pop_front();
+		    };
+
+	auto start = std::chrono::high_resolution_clock::now();
+	for (int i = 0; i < count; i++) {
+		if (inflight.size() == (size_t)window)
+			reap();
+		schedtest::syncobj soutobj(pool.get());
+		drm_sched_test_submit submit = {0, soutobj(), SCHED_TSTQ_A,
+			balanced ? (__u32)SCHED_TEST_SUBMIT_BALANCED : 0};
+		auto submitted = std::chrono::high_resolution_clock::now();
+		try {
+			f.callIoctl(DRM_IOCTL_SCHED_TEST_SUBMIT, &submit);
+		} catch (const std::system_error &ex) {
+			// Every queue but the fast one bypasses drm_sched, see bypass_queues
+			if (!balanced || (ex.code().value() != ENODEV))
+				throw;
+			std::cout << "Skipping balanced mode, no queue to balance over" << std::endl;
+			return;
+		}
+		inflight.push_back(std::make_pair(submitted, std::move(soutobj)));
+	}
+	while (!inflight.empty())
+		reap();
+
+	auto end = std::chrono::high_resolution_clock::now();
+	double delay = (std::chrono::duration_cast<std::chrono::microseconds>(end - start)).count();
+	double iops = ((double)count * 1000000.0)/delay;
+	iops /= 1000;
+	std::cout << "Mode: " << (balanced ? "balanced" : "static") << " IOPS: " << iops << " K/s";
+	std::cout << " Latency p50: " << schedtest::percentile(latencies, 50) << " us p99: "
+		  << schedtest::percentile(latencies, 99) << " us" << std::endl;
+}
+
+static void usage(const char *cmd)
+{
+	std::cout << "Usage " << cmd << " [-n <dev_node>] [-c <loop_count>] [-j <jobs>] [-w <window>] [-B]"
+		  << " [-m <model>[,<param0_ns>[,<param1_ns>[,<permille>]]]]\n";
+	throw std::invalid_argument("");
+}
+
+static void runJobs(const schedtest::testOptions &opts, bool balanced, const std::string &cmd)
+{
+	std::vector<std::string> args = {"-n", std::to_string(opts.minor), "-c", std::to_string(opts.count),
+					 "-w", std::to_string(opts.window)};
+	if (balanced)
+		args.push_back("-B");
+	schedtest::children(cmd, args, opts.jobs, "Child process").wait();
+}
+
+int main(int argc, char *argv[])
+{
+	try {
+		schedtest::testOptions opts;
+		opts.count = 10000;
+		opts.window = 16;
+		bool balanced = false;
+		int c;
+		while ((c = getopt (argc, argv, "n:c:j:w:Bm:")) != -1) {
+			if (schedtest::parseTestOption(c, optarg, opts))
+				continue;
+			if (c == 'B')
+				balanced = true;
+			else
+				usage(argv[0]);
+		}
+		if ((optind < argc) || (opts.window < 1)) {
+			usage(argv[0]);
+		}
+		schedtest::queueConfig hwConfig(opts.minor);
+		if (!opts.service.empty()) {
+			// Give every queue of the balancing group the same emulated HW
+			const drm_sched_test_queue_config config = schedtest::parseServiceModel(opts.service);
+			for (unsigned qu = SCHED_TSTQ_A; qu < schedtest::numQueues(); qu++) {
+				if (qu != SCHED_TSTQ_B)
+					hwConfig.configure(static_cast<sched_test_queue>(qu), config);
+			}
+		}
+
+		if (opts.jobs == 1) {
+			run(opts.minor, opts.count, opts.window, balanced);
+		}
+		else {
+			runJobs(opts, balanced, argv[0]);
+		}
+
+	} catch (std::exception &ex) {
+		std::cout << ex.what() << std::endl;
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,129 @@
+/* SPDX-License-Identifier: LGPL-2.1 OR MIT */
+/*
+ * Copyright (C) 2023 Advanced Micro Devices, Inc.
+ * Authors:
+ *     Sonal Santan <sonal.santan@amd.com>
+ */
+
+#include <drm/drm.h>
+#include <unistd.h>
+
+#include <iostream>
+#include <system_error>
+#include <cstring>
+#include <utility>
+#include <vector>
+#include <deque>
+#include <chrono>
+#include <thread>
+
+#include "sched_test.h"
+#include "common.h"
+
+static const char *priorityName(sched_test_priority prio)
+{
+	static const char *const names[SCHED_TEST_PRIORITY_MAX] = {"normal", "low", "high", "kernel"};
+	return names[prio];
+}
+
+void flood(const int node, int window)
+{
+	/*
+	 * Low priority flood like test1: keeps window jobs in flight on SCHED_TSTQ_A until killed
+	 */
+	const schedtest::raii f(node);
+	schedtest::syncobjPool pool(f.createPool(2 * window));
+	std::deque<schedtest::syncobj> inflight;
+	while (true) {
+		if (inflight.size() == (size_t)window) {
+			inflight.front().wait();
+			inflight.pop_front();
+		}
+		schedtest::syncobj soutobj(pool.get());
+		drm_sched_test_submit submit = {0, soutobj(), SCHED_TSTQ_A, 0, SCHED_TEST_PRIORITY_LOW, 0};
+		f.callIoctl(DRM_IOCTL_SCHED_TEST_SUBMIT, &submit);
+		inflight.push_back(std::move(soutobj));
+	}
+}
+
+void run(const int node, int count, sched_test_priority prio)
+{
+	/*
+	 * Latency sensitive stream like test2: submits a job at priority prio to SCHED_TSTQ_A
+	 * and waits for it before submitting the next one
+	 */
+	const schedtest::raii f(node);
+	f.showVersion();
+	// Only the submit to completion time should be measured, not the syncobj ioctls
+	schedtest::syncobjPool pool(f.createPool(1));
+	std::vector<double> latencies;
+	latencies.reserve(count);
+	for (int i = 0; i < count; i++) {
+		schedtest::syncobj soutobj(pool.get());
+		drm_sched_test_submit submit = {0, soutobj(), SCHED_TSTQ_A, 0, prio, 0};
+		auto start = std::chrono::high_resolution_clock::now();
+		f.callIoctl(DRM_IOCTL_SCHED_TEST_SUBMIT, &submit);
+		soutobj.wait();
+		auto end = std::chrono::high_resolution_clock::now();
+		latencies.push_back(std::chrono::duration<double, std::micro>(end - start).count());
+	}
+	std::cout << "Priority: " << priorityName(prio) << " Latency p50: " << schedtest::percentile(latencies, 50)
+		  << " us p99: " << schedtest::percentile(latencies, 99) << " us" << std::endl;
+}
+
+static void usage(const char *cmd)
+{
+	std::cout << "Usage " << cmd << " [-n <dev_node>] [-c <loop_count>] [-j <flood_jobs>] [-w <flood_window>]"
+		  << " [-m <model>[,<param0_ns>[,<param1_ns>[,<permille>]]]]\n";
+	throw std::invalid_argument("");
+}
+
+static void runAll(const schedtest::testOptions &opts, const std::string &cmd)
+{
+	// Measure the latency stream at normal and at high priority against the same flood
+	for (sched_test_priority prio : {SCHED_TEST_PRIORITY_NORMAL, SCHED_TEST_PRIORITY_HIGH}) {
+		// The flood processes have nothing useful to say
+		const schedtest::children flood(cmd, {"-n", std::to_string(opts.minor), "-w", std::to_string(opts.window),
+						      "-F"}, opts.jobs, "Flood process", true);
+		// Let the flood fill up the queue
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		run(opts.minor, opts.count, prio);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	try {
+		schedtest::testOptions opts;
+		opts.jobs = 4;
+		opts.count = 1000;
+		opts.window = 64;
+		bool flooder = false;
+		int c;
+		while ((c = getopt (argc, argv, "n:c:j:w:m:F")) != -1) {
+			if (schedtest::parseTestOption(c, optarg, opts))
+				continue;
+			if (c == 'F')
+				flooder = true;
+			else
+				usage(argv[0]);
+		}
+		if ((optind < argc) || (opts.window < 1)) {
+			usage(argv[0]);
+		}
+		if (flooder) {
+			flood(opts.minor, opts.window);
+			return 0;
+		}
+		schedtest::queueConfig hwConfig(opts.minor);
+		if (!opts.service.empty())
+			hwConfig.configure(SCHED_TSTQ_A, schedtest::parseServiceModel(opts.service));
+
+		runAll(opts, argv[0]);
+
+	} catch (std::exception &ex) {
+		std::cout << ex.what() << std::endl;
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,115 @@
+/* SPDX-License-Identifier: LGPL-2.1 OR MIT */
+/*
+ * Copyright (C) 2023 Advanced Micro Devices, Inc.
+ * Authors:
+ *     Sonal Santan <sonal.santan@amd.com>
+ */
+
+#include <drm/drm.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#include <iostream>
+#include <system_error>
+#include <cstring>
+#include <vector>
+#include <chrono>
+
+#include "sched_test.h"
+#include "common.h"
+
+void run(const int node, int count, int window)
+{
+	/*
+	 * Keeps up to window jobs in flight from a single thread. Every job exports its finished
+	 * fence as a sync_file which is added to an epoll set; completions are reaped from
+	 * epoll_wait, the way an event loop based service would multiplex outstanding jobs,
+	 * and each reaped completion makes room for the next submission
+	 */
+	const schedtest::raii f(node);
+	f.showVersion();
+	const int epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (epfd < 0)
+		throw std::system_error(errno, std::generic_category(), "epoll_create1");
+	std::vector<epoll_event> events(window);
+	int submitted = 0;
+	int completed = 0;
+	long wakeups = 0;
+
+	auto start = std::chrono::high_resolution_clock::now();
+	while (completed < count) {
+		for (; (submitted < count) && (submitted - completed < window); submitted++) {
+			drm_sched_test_submit submit = {0, 0, SCHED_TSTQ_A, SCHED_TEST_SUBMIT_OUT_SYNC_FILE};
+			f.callIoctl(DRM_IOCTL_SCHED_TEST_SUBMIT, &submit);
+			epoll_event event = {};
+			event.events = EPOLLIN;
+			event.data.fd = submit.out_sync_file;
+			if (epoll_ctl(epfd, EPOLL_CTL_ADD, submit.out_sync_file, &event) < 0)
+				throw std::system_error(errno, std::generic_category(), "epoll_ctl");
+		}
+		int ready = epoll_wait(epfd, events.data(), window, -1);
+		if (ready < 0) {
+			if (errno == EINTR)
+				continue;
+			throw std::system_error(errno, std::generic_category(), "epoll_wait");
+		}
+		wakeups++;
+		// Closing the sync_file also removes it from the epoll set
+		for (int i = 0; i < ready; i++)
+			close(events[i].data.fd);
+		completed += ready;
+	}
+	auto end = std::chrono::high_resolution_clock::now();
+	close(epfd);
+
+	double delay = (std::chrono::duration_cast<std::chrono::microseconds>(end - start)).count();
+	double iops = ((double)count * 1000000.0)/delay;
+	iops /= 1000;
+	std::cout << "Window: " << window << " IOPS: " << iops << " K/s Wakeups: "
+		  << (double)wakeups / count << " /job" << std::endl;
+}
+
+static void usage(const char *cmd)
+{
+	std::cout << "Usage " << cmd << " [-n <dev_node>] [-c <loop_count>] [-j <jobs>] [-w <window>]"
+		  << " [-m <model>[,<param0_ns>[,<param1_ns>[,<permille>]]]]\n";
+	throw std::invalid_argument("");
+}
+
+static void runJobs(const schedtest::testOptions &opts, const std::string &cmd)
+{
+	schedtest::children(cmd, {"-n", std::to_string(opts.minor), "-c", std::to_string(opts.count), "-w",
+				  std::to_string(opts.window)}, opts.jobs, "Child process").wait();
+}
+
+int main(int argc, char *argv[])
+{
+	try {
+		schedtest::testOptions opts;
+		opts.count = 100000;
+		opts.window = 256;
+		int c;
+		while ((c = getopt (argc, argv, "n:c:j:w:m:")) != -1) {
+			if (!schedtest::parseTestOption(c, optarg, opts))
+				usage(argv[0]);
+		}
+		if ((optind < argc) || (opts.window < 1)) {
+			usage(argv[0]);
+		}
+		schedtest::queueConfig hwConfig(opts.minor);
+		if (!opts.service.empty())
+			hwConfig.configure(SCHED_TSTQ_A, schedtest::parseServiceModel(opts.service));
+
+		if (opts.jobs == 1) {
+			run(opts.minor, opts.count, opts.window);
+		}
+		else {
+			runJobs(opts, argv[0]);
+		}
+
+	} catch (std::exception &ex) {
+		std::cout << ex.what() << std::endl;
+		return 1;
+	}
+	return 0;
+}
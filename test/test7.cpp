@@ -0,0 +1,229 @@
+/* SPDX-License-Identifier: LGPL-2.1 OR MIT */
+/*
+ * Copyright (C) 2023 Advanced Micro Devices, Inc.
+ * Authors:
+ *     Sonal Santan <sonal.santan@amd.com>
+ */
+
+#include <drm/drm.h>
+#include <sched.h>
+#include <unistd.h>
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <system_error>
+#include <stdexcept>
+#include <cstring>
+#include <cstdint>
+#include <vector>
+#include <chrono>
+
+#include "sched_test.h"
+#include "common.h"
+
+/*
+ * Measures the submit-then-wait round trip with the three parties of a job pinned to
+ * chosen CPUs: the submitting process, the queue's drm_sched thread and the queue's HW
+ * emulation thread. Placements are all on one core, spread over one last level cache,
+ * and across sockets.
+ */
+
+struct placement {
+	const char *name;
+	int submitter;
+	int sched;
+	int hwemu;
+};
+
+// Parses a sysfs CPU list like "0-3,8-11"
+static std::vector<int> parseCpuList(const std::string &list)
+{
+	std::vector<int> cpus;
+	std::istringstream ranges(list);
+	std::string range;
+	while (std::getline(ranges, range, ',')) {
+		const size_t dash = range.find('-');
+		const int first = std::stoi(range.substr(0, dash));
+		const int last = (dash == std::string::npos) ? first : std::stoi(range.substr(dash + 1));
+		for (int cpu = first; cpu <= last; cpu++)
+			cpus.push_back(cpu);
+	}
+	return cpus;
+}
+
+static std::string cpuSysfs(int cpu, const std::string &file)
+{
+	std::ifstream in("/sys/devices/system/cpu/cpu" + std::to_string(cpu) + "/" + file);
+	std::string value;
+	in >> value;
+	return value;
+}
+
+// CPUs sharing the last level cache with cpu, the highest cache index listed in sysfs
+static std::vector<int> llcCpus(int cpu)
+{
+	std::string list;
+	for (int index = 0; index < 8; index++) {
+		const std::string shared = cpuSysfs(cpu, "cache/index" + std::to_string(index) + "/shared_cpu_list");
+		if (shared.empty())
+			break;
+		list = shared;
+	}
+	return list.empty() ? std::vector<int>(1, cpu) : parseCpuList(list);
+}
+
+static std::vector<placement> placements(const std::string &which)
+{
+	cpu_set_t allowed;
+	if (sched_getaffinity(0, sizeof(allowed), &allowed))
+		throw std::system_error(errno, std::generic_category(), "sched_getaffinity");
+	std::vector<int> online;
+	for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+		if (CPU_ISSET(cpu, &allowed))
+			online.push_back(cpu);
+	}
+	const int home = online.front();
+	const std::string package = cpuSysfs(home, "topology/physical_package_id");
+	std::vector<placement> result;
+
+	if ((which == "all") || (which == "core"))
+		result.push_back({"same-core", home, home, home});
+
+	if ((which == "all") || (which == "llc")) {
+		std::vector<int> others;
+		for (int cpu : llcCpus(home)) {
+			if ((cpu != home) && CPU_ISSET(cpu, &allowed))
+				others.push_back(cpu);
+		}
+		if (others.size() >= 2)
+			result.push_back({"same-llc", home, others[0], others[1]});
+		else
+			std::cout << "Skipping same-llc, the last level cache of CPU " << home
+				  << " is not shared by 3 CPUs" << std::endl;
+	}
+
+	if ((which == "all") || (which == "socket")) {
+		// The drm_sched thread sits on the remote socket, so both handoffs of a job cross it
+		int remote = -1;
+		int local = home;
+		for (int cpu : online) {
+			const std::string cpuPackage = cpuSysfs(cpu, "topology/physical_package_id");
+			if ((remote < 0) && (cpuPackage != package))
+				remote = cpu;
+			if ((local == home) && (cpu != home) && (cpuPackage == package))
+				local = cpu;
+		}
+		if (remote >= 0)
+			result.push_back({"cross-socket", home, remote, local});
+		else
+			std::cout << "Skipping cross-socket, all CPUs are on one socket" << std::endl;
+	}
+	return result;
+}
+
+// Pins the calling thread to cpu and restores its original affinity on destruction
+class cpuPin {
+	cpu_set_t _saved;
+public:
+	cpuPin(int cpu) {
+		if (sched_getaffinity(0, sizeof(_saved), &_saved))
+			throw std::system_error(errno, std::generic_category(), "sched_getaffinity");
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(cpu, &set);
+		if (sched_setaffinity(0, sizeof(set), &set))
+			throw std::system_error(errno, std::generic_category(), "sched_setaffinity");
+	}
+	cpuPin(const cpuPin &) = delete;
+	cpuPin &operator=(const cpuPin &) = delete;
+	~cpuPin() {
+		if (sched_setaffinity(0, sizeof(_saved), &_saved)) {
+			const std::system_error eobj(errno, std::generic_category(), "sched_setaffinity");
+			std::cerr << eobj.what() << std::endl;
+		}
+	}
+};
+
+void run(const int node, int count, sched_test_queue qu, const placement &p)
+{
+	/*
+	 * Runs a loop which submits a job and then waits on it, all jobs signal successive
+	 * points of one timeline syncobj
+	 */
+	const schedtest::raii f(node);
+	// Both are undone also when the run throws, so the next placement starts clean
+	const schedtest::queueAffinity affinity(f, qu, p.hwemu, p.sched);
+	const cpuPin pin(p.submitter);
+
+	const schedtest::syncobj timeline(f.createSyncobj());
+	std::vector<double> latencies;
+	latencies.reserve(count);
+	auto start = std::chrono::high_resolution_clock::now();
+	for (int i = 1; i <= count; i++) {
+		drm_sched_test_submit submit = {0, timeline(), qu};
+		submit.out_point = i;
+		auto submitted = std::chrono::high_resolution_clock::now();
+		f.callIoctl(DRM_IOCTL_SCHED_TEST_SUBMIT, &submit);
+		timeline.wait(i);
+		auto done = std::chrono::high_resolution_clock::now();
+		latencies.push_back(std::chrono::duration<double, std::micro>(done - submitted).count());
+	}
+	auto end = std::chrono::high_resolution_clock::now();
+
+	double delay = (std::chrono::duration_cast<std::chrono::microseconds>(end - start)).count();
+	double iops = ((double)count * 1000000.0)/delay;
+	iops /= 1000;
+	std::cout << "Placement: " << p.name << " (submitter " << p.submitter << " drm_sched " << p.sched
+		  << " hwemu " << p.hwemu << ") IOPS: " << iops << " K/s Latency p50: "
+		  << schedtest::percentile(latencies, 50) << " us p99: " << schedtest::percentile(latencies, 99)
+		  << " us" << std::endl;
+}
+
+static void usage(const char *cmd)
+{
+	std::cout << "Usage " << cmd << " [-n <dev_node>] [-c <loop_count>] [-q <queue>] [-P all|core|llc|socket]"
+		  << " [-m <model>[,<param0_ns>[,<param1_ns>[,<permille>]]]]\n";
+	throw std::invalid_argument("");
+}
+
+int main(int argc, char *argv[])
+{
+	try {
+		schedtest::testOptions opts;
+		opts.count = 100000;
+		unsigned qu = SCHED_TSTQ_A;
+		std::string which = "all";
+		int c;
+		while ((c = getopt (argc, argv, "n:c:q:P:m:")) != -1) {
+			if (schedtest::parseTestOption(c, optarg, opts))
+				continue;
+			switch (c) {
+			case 'q':
+				qu = std::atoi(optarg);
+				break;
+			case 'P':
+				which = optarg;
+				break;
+			case '?':
+			default:
+				usage(argv[0]);
+			}
+		}
+		if ((optind < argc) || (qu >= schedtest::numQueues()) ||
+		    ((which != "all") && (which != "core") && (which != "llc") && (which != "socket"))) {
+			usage(argv[0]);
+		}
+		schedtest::queueConfig hwConfig(opts.minor);
+		if (!opts.service.empty())
+			hwConfig.configure(static_cast<sched_test_queue>(qu), schedtest::parseServiceModel(opts.service));
+
+		for (const placement &p : placements(which))
+			run(opts.minor, opts.count, static_cast<sched_test_queue>(qu), p);
+
+	} catch (std::exception &ex) {
+		std::cout << ex.what() << std::endl;
+		return 1;
+	}
+	return 0;
+}
@@ -19,22 +19,218 @@
 extern "C" {
 #endif
 
+/*
+ * The number of queues is set with the num_queues module parameter, from 1 up to
+ * SCHED_TEST_MAX_QUEUES; SCHED_TSTQ_MAX is the default. Any index below num_queues
+ * is a valid queue, the enumerators name the first two. SCHED_TSTQ_B is the fast
+ * queue: its jobs complete inline on the scheduler thread without going through the
+ * emulated HW, so it ignores the service time model.
+ */
 enum sched_test_queue {
 	SCHED_TSTQ_A,
 	SCHED_TSTQ_B,
 	SCHED_TSTQ_MAX
 };
 
+#define SCHED_TEST_MAX_QUEUES                     64
+
 #define DRM_SCHED_TEST_SUBMIT                     0x00
+#define DRM_SCHED_TEST_SUBMIT_BATCH               0x01
+#define DRM_SCHED_TEST_QUEUE_CONFIG               0x02
+#define DRM_SCHED_TEST_MICROBENCH                 0x03
+
+/*
+ * Submit the job to a scheduler picked by drm_sched from the group of equivalent
+ * queues, all queues but the fast SCHED_TSTQ_B, instead of to queue qu. drm_sched
+ * moves the file's balanced entity to the least loaded queue whenever it goes idle.
+ * Queues listed in the bypass_queues module parameter are not part of the group; the
+ * submission fails with -ENODEV when this leaves the group empty.
+ */
+#define SCHED_TEST_SUBMIT_BALANCED                (1 << 0)
+
+/*
+ * Export the job's finished fence as a sync_file and return its fd in out_sync_file.
+ * The fd can be polled for completion, e.g. with epoll, and has to be closed by the
+ * caller. With DRM_IOCTL_SCHED_TEST_SUBMIT_BATCH the fd is written back into the
+ * caller's descriptor. Should the sync_file not be created the job is still submitted
+ * and the ioctl fails with -ENOMEM, the batch counting the job.
+ */
+#define SCHED_TEST_SUBMIT_OUT_SYNC_FILE           (1 << 1)
+
+/*
+ * drm_sched priority level of a submission. Every file has one entity per queue and
+ * priority. SCHED_TEST_PRIORITY_KERNEL requires CAP_SYS_NICE.
+ */
+enum sched_test_priority {
+	/* Default */
+	SCHED_TEST_PRIORITY_NORMAL,
+	SCHED_TEST_PRIORITY_LOW,
+	SCHED_TEST_PRIORITY_HIGH,
+	SCHED_TEST_PRIORITY_KERNEL,
+	SCHED_TEST_PRIORITY_MAX
+};
 
+/* Maximum number of entries in drm_sched_test_submit::in_fences */
+#define SCHED_TEST_MAX_IN_FENCES                  256
+
+/*
+ * A syncobj handle and a timeline point, 0 for a binary syncobj. The pad must be
+ * zero.
+ */
+struct drm_sched_test_syncobj {
+	__u32 handle;
+	__u32 pad;
+	__u64 point;
+};
+
+/*
+ * in_fence and out_fence are syncobj handles, 0 for none. With a non-zero in_point
+ * (out_point) in_fence (out_fence) is a timeline syncobj and the job waits on
+ * (signals) that point; with 0 it is a binary syncobj.
+ *
+ * in_fences points to an array of in_fence_count drm_sched_test_syncobj entries the
+ * job waits on in addition to in_fence, so a job joining several upstream jobs is
+ * submitted with one ioctl.
+ */
 struct drm_sched_test_submit {
 	int in_fence;
 	int out_fence;
 	enum sched_test_queue qu;
+	__u32 flags;
+	__u32 priority;
+	__u32 in_fence_count;
+	__u64 in_point;
+	__u64 out_point;
+	__u64 in_fences;
+	__s32 out_sync_file;
+	__u32 pad;
+};
+
+/*
+ * Submit an array of drm_sched_test_submit descriptors with one ioctl. Each descriptor
+ * carries its own queue, in-fence and out-fence. stride is the size of one descriptor
+ * as seen by userspace, normally sizeof(struct drm_sched_test_submit); a stride which
+ * does not cover qu fails with EINVAL. Descriptors are submitted in array order; on
+ * return count holds the number of descriptors which were successfully submitted, also
+ * when the ioctl fails part way, e.g. with EINTR if the task got a fatal signal.
+ */
+struct drm_sched_test_submit_batch {
+	__u64 submits;
+	__u32 count;
+	__u32 stride;
+};
+
+
+/*
+ * Service time model of an emulated HW queue. The emulated HW processes the jobs of a
+ * queue one after the other and each job occupies it for a service time drawn from
+ * the model. With SCHED_TEST_SERVICE_NOP (the default) jobs complete immediately.
+ */
+enum sched_test_service_model {
+	/* Complete immediately */
+	SCHED_TEST_SERVICE_NOP,
+	/* param0_ns for every job */
+	SCHED_TEST_SERVICE_FIXED,
+	/* Uniformly distributed between param0_ns and param1_ns */
+	SCHED_TEST_SERVICE_UNIFORM,
+	/* Exponentially distributed with mean param0_ns */
+	SCHED_TEST_SERVICE_EXPONENTIAL,
+	/* param1_ns for permille out of 1000 jobs, param0_ns for the rest */
+	SCHED_TEST_SERVICE_BIMODAL,
+	SCHED_TEST_SERVICE_MAX
 };
 
+/*
+ * Upper bound of param0_ns and param1_ns, and of any service time drawn from a model,
+ * well below the 500 ms timeout of the DRM schedulers
+ */
+#define SCHED_TEST_SERVICE_MAX_NS                 (50ULL * 1000 * 1000)
+
+/*
+ * Completion backend of an emulated HW queue, the context the irq fences of its jobs
+ * are signaled from
+ */
+enum sched_test_backend {
+	/* Default, a kernel thread per queue */
+	SCHED_TEST_BACKEND_KTHREAD,
+	/* A hrtimer per queue firing in hard IRQ context (softirq on PREEMPT_RT), like a real HW interrupt */
+	SCHED_TEST_BACKEND_HRTIMER,
+	SCHED_TEST_BACKEND_MAX
+};
+
+/*
+ * Set the CPU placement of the queue instead of its service time model and backend:
+ * the HW emulation thread is pinned to hwemu_cpu and the queue's drm_sched thread to
+ * sched_cpu, -1 lets the thread float. Either both threads move or neither does.
+ * hwemu_cpu has no effect while the queue uses SCHED_TEST_BACKEND_HRTIMER, whose timer
+ * fires on the CPU it was started from. Requires CAP_SYS_NICE.
+ */
+#define SCHED_TEST_QUEUE_CONFIG_AFFINITY          (1 << 0)
+
+/*
+ * Configure the emulated HW behind queue qu. This changes device wide state which
+ * affects every client of the queue, so it requires CAP_SYS_ADMIN. The service time
+ * model sets the completion delay of either backend.
+ */
+struct drm_sched_test_queue_config {
+	__u32 qu;
+	__u32 model;
+	__u64 param0_ns;
+	__u64 param1_ns;
+	__u32 permille;
+	__u32 backend;
+	__u32 flags;
+	__s32 hwemu_cpu;
+	__s32 sched_cpu;
+	__u32 pad;
+};
+
+/* Dependency pattern of the jobs generated by DRM_IOCTL_SCHED_TEST_MICROBENCH */
+enum sched_test_microbench_pattern {
+	/* No dependencies */
+	SCHED_TEST_MICROBENCH_INDEPENDENT,
+	/* Every job depends on the finished fence of the previous one */
+	SCHED_TEST_MICROBENCH_CHAIN,
+	SCHED_TEST_MICROBENCH_MAX
+};
+
+/* Maximum drm_sched_test_microbench::count */
+#define SCHED_TEST_MICROBENCH_MAX_JOBS            (1 << 20)
+
+/* drm_sched_test_microbench::status, a signal cut the run short */
+#define SCHED_TEST_MICROBENCH_INTERRUPTED         (1 << 0)
+
+/*
+ * Generate count jobs in the driver and push them to the caller's entity for queue qu
+ * and priority, without any syncobj or userspace involvement, then wait for the last
+ * one to complete. Requires CAP_SYS_ADMIN. On return count holds the number of jobs
+ * pushed and the *_ns fields the time spent, summed over all jobs, in
+ * sched_test_job_alloc(), sched_test_job_init() and sched_test_job_arm(), adding
+ * the dependency and sched_test_job_push() (drm_sched_entity_push_job()). wait_ns is
+ * the time from the last push until the last job completed and total_ns the time of the
+ * whole run. A fatal signal ends the run early and any signal the final wait; the
+ * ioctl then still succeeds, with the partial results and SCHED_TEST_MICROBENCH_INTERRUPTED
+ * set in status, so it is never restarted behind the caller's back.
+ */
+struct drm_sched_test_microbench {
+	__u32 qu;
+	__u32 count;
+	__u32 pattern;
+	__u32 priority;
+	__u64 alloc_ns;
+	__u64 init_ns;
+	__u64 deps_ns;
+	__u64 push_ns;
+	__u64 wait_ns;
+	__u64 total_ns;
+	__u32 status;
+	__u32 pad;
+};
 
 #define DRM_IOCTL_SCHED_TEST_SUBMIT           DRM_IOWR(DRM_COMMAND_BASE + DRM_SCHED_TEST_SUBMIT, struct drm_sched_test_submit)
+#define DRM_IOCTL_SCHED_TEST_SUBMIT_BATCH     DRM_IOWR(DRM_COMMAND_BASE + DRM_SCHED_TEST_SUBMIT_BATCH, struct drm_sched_test_submit_batch)
+#define DRM_IOCTL_SCHED_TEST_QUEUE_CONFIG     DRM_IOW(DRM_COMMAND_BASE + DRM_SCHED_TEST_QUEUE_CONFIG, struct drm_sched_test_queue_config)
+#define DRM_IOCTL_SCHED_TEST_MICROBENCH       DRM_IOWR(DRM_COMMAND_BASE + DRM_SCHED_TEST_MICROBENCH, struct drm_sched_test_microbench)
 
 #if defined(__cplusplus)
 }